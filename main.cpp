@@ -3,8 +3,22 @@
 #include <vector>
 #include <string>
 #include <cstring>
+#include <algorithm>
 
 #include "SegmentedFile.h"
+#include "SegmentedFileDecompressor.h"
+#include "BundlePatch.h"
+#include "HeaderCache.h"
+#include "AllocationCounter.h"
+#include "BundleStress.h"
+
+#ifndef _WIN32
+#include "ResourceServer.h"
+#endif
+
+#ifdef WITH_FUSE
+#include "BundleFilesystem.h"
+#endif
 
 #include  "MurmurHash2/MurmurHash2.h"
 
@@ -21,10 +35,19 @@ int main(int argc, char ** argv)
 
 #ifdef NDEBUG
 
-  if (argc != 4)
+  if (argc < 4)
   {
     std::cerr << "Invalid arguments count. Example:\n"
-              << argv[0] << " -c FileIn.pack FileOut.lua\n";
+              << argv[0] << " -c FileIn.pack FileOut.lua [--deterministic] [--threads=N]\n"
+              << argv[0] << " -D BundlesFolder OutFolder [--dedup=hardlink|reflink|manifest] [--memory-limit=MiB] [--threads=N] [--readahead=Segments]\n"
+              << "      [--include-type=lua,strings] [--exclude-type=texture] [--include-name=Hash,...] [--names-file=Names.txt]\n"
+              << "      [--header-cache=Headers.cache] [--layout=flat|per-type|sharded]\n"
+              << argv[0] << " mkpatch OldBundle NewBundle Bundle.patch\n"
+              << argv[0] << " applypatch OldBundle Bundle.patch NewBundle\n"
+              << argv[0] << " list BundlesFolder Headers.cache\n"
+              << argv[0] << " stress all|many-records|full-segments|many-chunks|stream-sizes|truncated|mutated WorkFolder [--seed=N] [--iterations=N] [--records=N]\n"
+              << argv[0] << " -s BundlesFolder Server.sock [--header-cache=Headers.cache]\n"
+              << argv[0] << " -m BundlesFolder MountPoint [--header-cache=Headers.cache]\n";
 
     return 1;
   }
@@ -35,6 +58,8 @@ int main(int argc, char ** argv)
   const char * file_in;
   const char * file_out;
 
+  std::vector<std::string> options;
+
 #ifndef NDEBUG
 
 #ifdef TEST_COMPRESS
@@ -51,18 +76,42 @@ int main(int argc, char ** argv)
 
 #endif
 
-#elif
+#else
 
   mode     = argv[1];
   file_in  = argv[2];
   file_out = argv[3];
 
+  options.assign(argv + 4, argv + argc);
+
 #endif
 
   SegmentedFile decompressor;
 
+  // Value of a --name=value option, empty when absent
+  const auto option_value = [&](const std::string & name)
+  {
+    for (const auto & option : options)
+    {
+      if (option.rfind(name, 0) == 0)
+        return option.substr(name.size());
+    }
+
+    return std::string();
+  };
+
   if (strcmp(mode, "-c") == 0)
   {
+    for (const auto & option : options)
+    {
+      if (option == "--deterministic")
+        decompressor.SetDeterministic(true);
+      else if (option.rfind("--threads=", 0) == 0)
+        decompressor.SetThreadCount(std::stoul(option.substr(10)));
+      else
+        std::cerr << "Unknown option " << option << std::endl;
+    }
+
     if (!decompressor.Compress(file_in, file_out))
       std::cerr << "Error\n" << std::endl;
   }
@@ -71,6 +120,166 @@ int main(int argc, char ** argv)
     if (!decompressor.Decompress(file_in, file_out))
       std::cerr << "Error\n" << std::endl;
   }
+  else if (strcmp(mode, "-D") == 0)
+  {
+    SegmentedFileDecompressor folder_decompressor;
+    ResourceFilter            filter;
+
+    // Comma separated option values
+    const auto for_each_value = [](const std::string & values, auto callback)
+    {
+      for (size_t begin = 0, end; begin <= values.size(); begin = end + 1)
+      {
+        end = std::min(values.find(',', begin), values.size());
+
+        if (end > begin)
+          callback(values.substr(begin, end - begin));
+      }
+    };
+
+    for (const auto & option : options)
+    {
+      if (option == "--dedup=hardlink")
+        folder_decompressor.SetDedupMode(SegmentedFileDecompressor::DedupMode::Hardlink);
+      else if (option == "--dedup=reflink")
+        folder_decompressor.SetDedupMode(SegmentedFileDecompressor::DedupMode::Reflink);
+      else if (option == "--dedup=manifest")
+        folder_decompressor.SetDedupMode(SegmentedFileDecompressor::DedupMode::Manifest);
+      else if (option == "--layout=flat")
+        folder_decompressor.SetOutputLayout(SegmentedFileDecompressor::OutputLayout::Flat);
+      else if (option == "--layout=per-type")
+        folder_decompressor.SetOutputLayout(SegmentedFileDecompressor::OutputLayout::PerType);
+      else if (option == "--layout=sharded")
+        folder_decompressor.SetOutputLayout(SegmentedFileDecompressor::OutputLayout::Sharded);
+      else if (option.rfind("--memory-limit=", 0) == 0)
+        folder_decompressor.SetMemoryLimit(std::stoull(option.substr(15)) * 1024 * 1024);
+      else if (option.rfind("--threads=", 0) == 0)
+        folder_decompressor.SetThreadCount(std::stoul(option.substr(10)));
+      else if (option.rfind("--readahead=", 0) == 0)
+        folder_decompressor.SetReadahead(std::stoul(option.substr(12)));
+      else if (option.rfind("--include-type=", 0) == 0)
+        for_each_value(option.substr(15), [&](const std::string & type) { filter.IncludeType(type); });
+      else if (option.rfind("--exclude-type=", 0) == 0)
+        for_each_value(option.substr(15), [&](const std::string & type) { filter.ExcludeType(type); });
+      else if (option.rfind("--include-name=", 0) == 0)
+      {
+        for_each_value(option.substr(15), [&](const std::string & name)
+        {
+          uint64_t name_hash = 0;
+
+          if (ResourceFilter::ParseNameHash(name, name_hash))
+            filter.IncludeName(name_hash);
+          else
+            std::cerr << "Invalid name hash " << name << std::endl;
+        });
+      }
+      else if (option.rfind("--header-cache=", 0) == 0)
+        folder_decompressor.SetHeaderCache(option.substr(15));
+      else if (option.rfind("--names-file=", 0) == 0)
+      {
+        if (!filter.IncludeNamesFromFile(option.substr(13)))
+          std::cerr << "Cannot read " << option.substr(13) << std::endl;
+      }
+      else
+        std::cerr << "Unknown option " << option << std::endl;
+    }
+
+    folder_decompressor.SetFilter(filter);
+
+    // Only filtered extraction reads record tables, a full unpack inflates every segment anyway
+    if (filter.IsEmpty() && !option_value("--header-cache=").empty())
+    {
+      std::cerr << "--header-cache needs --include-type, --exclude-type, --include-name or --names-file" << std::endl;
+      return 1;
+    }
+
+    // Filtered extraction reads one resource at a time on this thread
+    if (!filter.IsEmpty() && (!option_value("--memory-limit=").empty() || !option_value("--threads=").empty()))
+      std::cerr << "--memory-limit and --threads do not apply with a filter and are ignored" << std::endl;
+
+    if (!folder_decompressor.Decompress(file_in, file_out))
+      std::cerr << "Error\n" << std::endl;
+
+    const auto & statistics = folder_decompressor.GetStatistics();
+
+    std::cout << statistics.BundlesProcessed << " bundles unpacked, "
+              << statistics.BufferAllocations << " buffer allocations, "
+              << statistics.DuplicateResources << " duplicates (" << statistics.DuplicateBytes << " bytes) shared, "
+              << statistics.PeakBytesInFlight << " peak bytes in flight" << std::endl;
+
+    if (statistics.WriteFailures != 0)
+      std::cerr << statistics.WriteFailures << " resources could not be written" << std::endl;
+
+    if (AllocationCounter::IsEnabled())
+      std::cout << statistics.HeapAllocations << " heap allocations unpacking " << statistics.BundlesProcessed << " bundles" << std::endl;
+
+    if (!filter.IsEmpty())
+      std::cout << statistics.ResourcesSkipped << " resources filtered out, "
+                << statistics.SegmentsInflated << " of " << statistics.SegmentsTotal << " segments inflated" << std::endl;
+  }
+  else if (strcmp(mode, "mkpatch") == 0 || strcmp(mode, "applypatch") == 0)
+  {
+    BundlePatch patch;
+
+    if (options.empty())
+      std::cerr << "Missing output file\n" << std::endl;
+    else if (strcmp(mode, "mkpatch") == 0 ? !patch.Create(file_in, file_out, options[0]) : !patch.Apply(file_in, file_out, options[0]))
+      std::cerr << "Error\n" << std::endl;
+  }
+  else if (strcmp(mode, "stress") == 0)
+  {
+    BundleStress          stress;
+    BundleStress::Options stress_options;
+
+    for (const auto & option : options)
+    {
+      if (option.rfind("--seed=", 0) == 0)
+        stress_options.Seed = std::stoull(option.substr(7));
+      else if (option.rfind("--iterations=", 0) == 0)
+        stress_options.Iterations = std::stoul(option.substr(13));
+      else if (option.rfind("--records=", 0) == 0)
+        stress_options.Records = std::stoul(option.substr(10));
+      else
+        std::cerr << "Unknown option " << option << std::endl;
+    }
+
+    if (!stress.Run(file_in, file_out, stress_options))
+      return 1;
+  }
+  else if (strcmp(mode, "list") == 0)
+  {
+    SegmentCache cache;
+    HeaderCache  headers;
+
+    const bool listed = headers.VisitFolder(file_in, file_out, &cache, [](BundleIndex & bundle, uint64_t, uint64_t)
+    {
+      for (const auto & resource : bundle.GetResources())
+        std::cout << bundle.GetFileName() << ' ' << resource.TypeHash << ' ' << resource.NameHash << ' ' << resource.Size << '\n';
+
+      return true;
+    });
+
+    if (!listed)
+      std::cerr << "Error\n" << std::endl;
+  }
+#ifndef _WIN32
+  else if (strcmp(mode, "-s") == 0)
+  {
+    ResourceServer server;
+
+    if (!server.Load(file_in, option_value("--header-cache=")) || !server.Serve(file_out))
+      std::cerr << "Error\n" << std::endl;
+  }
+#endif
+#ifdef WITH_FUSE
+  else if (strcmp(mode, "-m") == 0)
+  {
+    BundleFilesystem filesystem;
+
+    if (!filesystem.Load(file_in, option_value("--header-cache=")) || filesystem.Mount(file_out) != 0)
+      std::cerr << "Error\n" << std::endl;
+  }
+#endif
   
   return 0;
 }
@@ -0,0 +1,64 @@
+#include "AllocationCounter.h"
+
+#ifdef COUNT_ALLOCATIONS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+  std::atomic<uint64_t> Count{ 0 };
+}
+
+// Array and nothrow forms end up here through their default definitions
+void * operator new(
+    std::size_t _Size
+  )
+{
+  Count.fetch_add(1, std::memory_order_relaxed);
+
+  if (void * Pointer = std::malloc(_Size != 0 ? _Size : 1))
+    return Pointer;
+
+  throw std::bad_alloc();
+}
+
+void operator delete(
+    void * _Pointer
+  ) noexcept
+{
+  std::free(_Pointer);
+}
+
+void operator delete(
+    void *      _Pointer,
+    std::size_t
+  ) noexcept
+{
+  std::free(_Pointer);
+}
+
+#endif
+
+//
+// Interface
+//
+
+bool AllocationCounter::IsEnabled()
+{
+#ifdef COUNT_ALLOCATIONS
+  return true;
+#else
+  return false;
+#endif
+}
+
+uint64_t AllocationCounter::GetCount()
+{
+#ifdef COUNT_ALLOCATIONS
+  return Count.load(std::memory_order_relaxed);
+#else
+  return 0;
+#endif
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <cstdint>
+
+// Process wide count of heap allocations, for checking that hot loops stay
+// allocation free. Only builds configured with -DCOUNT_ALLOCATIONS=ON replace
+// the global operator new to count, elsewhere the count stays zero.
+class AllocationCounter
+{
+public: // Interface
+
+  static bool IsEnabled();
+
+  static uint64_t GetCount();
+};
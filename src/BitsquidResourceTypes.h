@@ -0,0 +1,52 @@
+#pragma once
+#include <array>
+#include <utility>
+
+namespace utility
+{
+  // Known resource types and the extension their extracted files get
+  inline constexpr std::array BitsquidResourceNames
+  {
+      std::pair{"config", ".txt" },
+      std::pair{"render_config", ".txt" },
+      std::pair{"unit", ".dat"},
+      std::pair{"shader_library_group", ".txt"},
+      std::pair{"shader_library", ".txt"},
+      std::pair{"shader", ".txt"},
+      std::pair{"texture", ".txt"},
+      std::pair{"material", ".txt"},
+      std::pair{"animation", ".txt"},
+      std::pair{"animation_curves", ".txt"},
+      std::pair{"bones", ".txt"},
+      std::pair{"state_machine", ".txt"},
+      std::pair{"physics_properties", ".txt"},
+      std::pair{"package", ".txt"},
+      std::pair{"particles", ".txt"},
+      std::pair{"sound_environment", ".txt"},
+      std::pair{"font", ".ttf"},
+      std::pair{"vaw", ".txt"},
+      std::pair{"aul", ".txt"},
+      std::pair{"level", ".txt"},
+      std::pair{"data", ".txt"},
+      std::pair{"shading_environment", ".txt"},
+      std::pair{"strings", ".txt"},
+      std::pair{"network_config", ".txt"},
+      std::pair{"mouse_cursor", ".txt"},
+      std::pair{"timpani_bank", ".txt"},
+      std::pair{"flow", ".txt"},
+      std::pair{"surface_properties", ".txt"},
+      std::pair{"baked_lighting", ".txt"},
+      std::pair{"mp4", ".txt"},
+      std::pair{"ivf", ".txt"},
+      std::pair{"bik", ".txt"},
+      std::pair{"vector_field", ".txt"},
+      std::pair{"cane", ".txt"},
+      std::pair{"cane_tilecache", ".txt"},
+      std::pair{"entity", ".txt"},
+      std::pair{"scene", ".txt"},
+      std::pair{"bpa", ".txt"},
+      std::pair{"lua", ".lua"},
+      std::pair{"script", ".lua"},
+      std::pair{"scripts", ".lua"}
+  };
+}
@@ -0,0 +1,301 @@
+#include "BundleFilesystem.h"
+
+#define FUSE_USE_VERSION 31
+#include <fuse.h>
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+
+#include "MurmurHash2/MurmurHash2.h"
+#include "BitsquidResourceTypes.h"
+
+namespace
+{
+  BundleFilesystem & GetFilesystem()
+  {
+    return *static_cast<BundleFilesystem *>(fuse_get_context()->private_data);
+  }
+
+  void * Init(fuse_conn_info *, fuse_config * _Config)
+  {
+    // Bundles are immutable while mounted
+    _Config->kernel_cache = 1;
+    _Config->entry_timeout = _Config->attr_timeout = 3600;
+
+    return fuse_get_context()->private_data;
+  }
+
+  int GetAttributes(const char * _Path, struct stat * _Stat, fuse_file_info *)
+  {
+    std::memset(_Stat, 0, sizeof(*_Stat));
+
+    if (std::strcmp(_Path, "/") == 0 || GetFilesystem().FindDirectory(_Path))
+    {
+      _Stat->st_mode  = S_IFDIR | 0555;
+      _Stat->st_nlink = 2;
+
+      return 0;
+    }
+
+    if (const auto * File = GetFilesystem().FindFile(_Path))
+    {
+      _Stat->st_mode  = S_IFREG | 0444;
+      _Stat->st_nlink = 1;
+      _Stat->st_size  = File->Resource->Size;
+
+      return 0;
+    }
+
+    return -ENOENT;
+  }
+
+  int ReadDirectory(const char * _Path, void * _Buffer, fuse_fill_dir_t _Filler, off_t, fuse_file_info *, fuse_readdir_flags)
+  {
+    const auto Fill = [&](const std::string & _Name)
+    {
+      _Filler(_Buffer, _Name.c_str(), nullptr, 0, static_cast<fuse_fill_dir_flags>(0));
+    };
+
+    Fill(".");
+    Fill("..");
+
+    if (std::strcmp(_Path, "/") == 0)
+    {
+      for (const auto & [Type, _] : GetFilesystem().GetDirectories())
+        Fill(Type);
+
+      return 0;
+    }
+
+    const auto * Directory = GetFilesystem().FindDirectory(_Path);
+
+    if (!Directory)
+      return -ENOENT;
+
+    for (const auto & [Name, _] : *Directory)
+      Fill(Name);
+
+    return 0;
+  }
+
+  int Open(const char * _Path, fuse_file_info * _Info)
+  {
+    const auto * File = GetFilesystem().FindFile(_Path);
+
+    if (!File)
+      return -ENOENT;
+
+    if ((_Info->flags & O_ACCMODE) != O_RDONLY)
+      return -EROFS;
+
+    _Info->fh         = reinterpret_cast<uint64_t>(File);
+    _Info->keep_cache = 1;
+
+    return 0;
+  }
+
+  int Read(const char *, char * _Buffer, size_t _Size, off_t _Offset, fuse_file_info * _Info)
+  {
+    const auto * File = reinterpret_cast<const BundleFilesystem::File *>(_Info->fh);
+
+    return static_cast<int>(GetFilesystem().ReadFile(*File, _Buffer, _Size, _Offset));
+  }
+}
+
+//
+// Construction
+//
+
+BundleFilesystem::~BundleFilesystem()
+{
+  {
+    std::lock_guard Lock(m_ReadaheadMutex);
+    m_Stopping = true;
+  }
+
+  m_ReadaheadCondition.notify_all();
+
+  if (m_ReadaheadThread.joinable())
+    m_ReadaheadThread.join();
+}
+
+//
+// Interface
+//
+
+bool BundleFilesystem::Load(
+    const std::string & _Folder,
+    const std::string & _HeaderCacheFile
+  )
+{
+  if (!m_Headers.IndexFolder(_Folder, _HeaderCacheFile, &m_Cache, m_Bundles))
+    return false;
+
+  std::map<uint64_t, std::string> TypeNames;
+
+  for (const auto & [Type, Format] : utility::BitsquidResourceNames)
+    TypeNames[MurmurHash64A(Type, static_cast<int>(strlen(Type)), 0)] = Type;
+
+  for (const auto & Bundle : m_Bundles)
+  {
+    for (const auto & Resource : Bundle->GetResources())
+    {
+      const auto        TypeName = TypeNames.find(Resource.TypeHash);
+      const std::string Type     = TypeName != TypeNames.end() ? TypeName->second : std::to_string(Resource.TypeHash);
+
+      // The first bundle providing a resource wins, like a loader would do
+      m_Directories[Type].emplace(std::to_string(Resource.NameHash), File{ Bundle.get(), &Resource });
+    }
+  }
+
+  return true;
+}
+
+int BundleFilesystem::Mount(
+    const std::string & _MountPoint
+  )
+{
+  m_ReadaheadThread = std::thread(&BundleFilesystem::ReadaheadLoop, this);
+
+  fuse_operations Operations{};
+  Operations.init    = Init;
+  Operations.getattr = GetAttributes;
+  Operations.readdir = ReadDirectory;
+  Operations.open    = Open;
+  Operations.read    = Read;
+
+  std::vector<std::string> Arguments{ "MagickaUnpacker", _MountPoint, "-f", "-o", "ro,default_permissions" };
+  std::vector<char *>      ArgumentPointers;
+
+  for (auto & Argument : Arguments)
+    ArgumentPointers.push_back(Argument.data());
+
+  return fuse_main(static_cast<int>(ArgumentPointers.size()), ArgumentPointers.data(), &Operations, this);
+}
+
+//
+// Service
+//
+
+const BundleFilesystem::Directory * BundleFilesystem::FindDirectory(
+    const std::string & _Path
+  ) const
+{
+  if (_Path.size() < 2 || _Path.find('/', 1) != std::string::npos)
+    return nullptr;
+
+  const auto it = m_Directories.find(_Path.substr(1));
+
+  return it != m_Directories.end() ? &it->second : nullptr;
+}
+
+const BundleFilesystem::File * BundleFilesystem::FindFile(
+    const std::string & _Path
+  ) const
+{
+  const size_t Separator = _Path.find('/', 1);
+
+  if (Separator == std::string::npos)
+    return nullptr;
+
+  const auto Directory = m_Directories.find(_Path.substr(1, Separator - 1));
+
+  if (Directory == m_Directories.end())
+    return nullptr;
+
+  const auto it = Directory->second.find(_Path.substr(Separator + 1));
+
+  return it != Directory->second.end() ? &it->second : nullptr;
+}
+
+const std::map<std::string, BundleFilesystem::Directory> & BundleFilesystem::GetDirectories() const
+{
+  return m_Directories;
+}
+
+int64_t BundleFilesystem::ReadFile(
+    const File & _File,
+    char *       _Destination,
+    uint64_t     _Size,
+    uint64_t     _Offset
+  )
+{
+  const BundleIndex::Resource & Resource = *_File.Resource;
+
+  if (_Offset >= Resource.Size)
+    return 0;
+
+  _Size = std::min(_Size, Resource.Size - _Offset);
+
+  if (!m_OpenBundles.Acquire(*_File.Bundle))
+    return -EIO;
+
+  const bool Success = _File.Bundle->Read(Resource.Offset + _Offset, _Destination, _Size);
+
+  m_OpenBundles.Release(*_File.Bundle);
+
+  if (!Success)
+    return -EIO;
+
+  // Warm up the segments a sequential reader is going to ask for next
+  const uint64_t End  = Resource.Offset + Resource.Size;
+  const uint64_t Next = Resource.Offset + _Offset + _Size;
+
+  if (Next < End)
+    ScheduleReadahead(_File.Bundle, static_cast<uint32_t>(Next / BundleIndex::SEGMENT_SIZE));
+
+  return static_cast<int64_t>(_Size);
+}
+
+void BundleFilesystem::ScheduleReadahead(
+    BundleIndex * _Bundle,
+    uint32_t      _Segment
+  )
+{
+  {
+    std::lock_guard Lock(m_ReadaheadMutex);
+
+    const uint32_t Last = std::min<uint32_t>(_Segment + READAHEAD_SEGMENTS, static_cast<uint32_t>(_Bundle->GetSegments().size()));
+
+    for (uint32_t Segment = _Segment; Segment < Last; ++Segment)
+    {
+      if (!_Bundle->IsStored(Segment))
+        m_ReadaheadQueue.emplace_back(_Bundle, Segment);
+    }
+
+    // Stale requests are useless once the reader moved on
+    while (m_ReadaheadQueue.size() > READAHEAD_SEGMENTS * 16)
+      m_ReadaheadQueue.pop_front();
+  }
+
+  m_ReadaheadCondition.notify_one();
+}
+
+void BundleFilesystem::ReadaheadLoop()
+{
+  for (;;)
+  {
+    std::pair<BundleIndex *, uint32_t> Request;
+
+    {
+      std::unique_lock Lock(m_ReadaheadMutex);
+      m_ReadaheadCondition.wait(Lock, [this] { return m_Stopping || !m_ReadaheadQueue.empty(); });
+
+      if (m_Stopping)
+        return;
+
+      Request = m_ReadaheadQueue.front();
+      m_ReadaheadQueue.pop_front();
+    }
+
+    // Goes through the shared cache, a hit costs only a lookup
+    if (!m_OpenBundles.Acquire(*Request.first))
+      continue;
+
+    Request.first->InflateSegment(Request.second);
+    m_OpenBundles.Release(*Request.first);
+  }
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <cstdint>
+
+#include "BundleIndex.h"
+#include "SegmentCache.h"
+#include "HeaderCache.h"
+#include "OpenBundleCache.h"
+
+// Read only FUSE view of a bundles folder as <type>/<name hash> files.
+// File contents are served straight from the mapped bundles, inflating
+// only the segments a read covers. Bundles are mapped on first read and
+// closed again once too many are open.
+class BundleFilesystem
+{
+public: // Construction
+
+  BundleFilesystem() = default;
+  ~BundleFilesystem();
+
+public: // Interface
+
+  // A non empty _HeaderCacheFile is used and refreshed to skip bundle scanning
+  bool Load(
+      const std::string & _Folder,
+      const std::string & _HeaderCacheFile = ""
+    );
+
+  // Blocks until the filesystem is unmounted
+  int Mount(
+      const std::string & _MountPoint
+    );
+
+public: // Service
+
+  struct File
+  {
+    BundleIndex *                 Bundle;
+    const BundleIndex::Resource * Resource;
+  };
+
+  using Directory = std::map<std::string, File>;
+
+  const Directory * FindDirectory(
+      const std::string & _Path
+    ) const;
+
+  const File * FindFile(
+      const std::string & _Path
+    ) const;
+
+  const std::map<std::string, Directory> & GetDirectories() const;
+
+  int64_t ReadFile(
+      const File & _File,
+      char *       _Destination,
+      uint64_t     _Size,
+      uint64_t     _Offset
+    );
+
+protected: // Service
+
+  void ScheduleReadahead(
+      BundleIndex * _Bundle,
+      uint32_t      _Segment
+    );
+
+  void ReadaheadLoop();
+
+protected: // Members
+
+  static constexpr uint32_t READAHEAD_SEGMENTS = 4;
+
+  SegmentCache                                          m_Cache;
+  HeaderCache                                           m_Headers;
+  OpenBundleCache                                       m_OpenBundles;
+  std::vector<std::unique_ptr<BundleIndex>>             m_Bundles;
+  std::map<std::string, Directory>                      m_Directories;
+
+  std::thread                                           m_ReadaheadThread;
+  std::mutex                                            m_ReadaheadMutex;
+  std::condition_variable                               m_ReadaheadCondition;
+  std::deque<std::pair<BundleIndex *, uint32_t>>        m_ReadaheadQueue;
+  bool                                                  m_Stopping = false;
+};
@@ -0,0 +1,77 @@
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+#include "SegmentedFile.h"
+#include "BundleIndex.h"
+#include "PackageParser.h"
+
+// libFuzzer entry point, built with -DBUILD_FUZZER=ON. Every input is taken
+// as a bundle file by BundleIndex and SegmentedFile and as an inflated
+// package by PackageParser.
+
+namespace
+{
+  class ReferenceUnpacker : public SegmentedFile
+  {
+  public:
+
+    using SegmentedFile::ReadSegmentCompressedFile;
+    using SegmentedFile::UnpackBitsquidPackage;
+  };
+
+  // One folder per process, parallel fuzzing jobs must not share files
+  const std::filesystem::path & GetWorkFolder()
+  {
+    static const std::filesystem::path Folder = []
+    {
+      const auto Path = std::filesystem::temp_directory_path() / ("BundleFuzzer" + std::to_string(std::random_device{}()));
+
+      std::error_code Error;
+      std::filesystem::create_directories(Path / "unpack", Error);
+
+      return Path;
+    }();
+
+    return Folder;
+  }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t * _Data, size_t _Size)
+{
+  const std::string FileName = (GetWorkFolder() / "bundle").string();
+
+  {
+    std::ofstream File(FileName, std::ios::binary | std::ios::trunc);
+    File.write(reinterpret_cast<const char *>(_Data), _Size);
+  }
+
+  // Random access index, every resource read back through the segment cache
+  SegmentCache Cache(4 * 1024 * 1024);
+  BundleIndex  Index;
+
+  if (Index.Open(FileName, &Cache))
+  {
+    std::vector<unsigned char> Buffer;
+
+    for (const auto & Resource : Index.GetResources())
+    {
+      Buffer.resize(std::min<uint64_t>(Resource.Size, 1024 * 1024));
+      Index.Read(Resource.Offset, Buffer.data(), Buffer.size());
+    }
+  }
+
+  // Incremental parser, fed the input as one inflated package
+  PackageParser Parser([](const PackageParser::Record &, uint64_t) {}, [](const unsigned char *, uint64_t) {});
+  Parser.Feed(_Data, _Size);
+
+  // Reference reader and unpacker
+  ReferenceUnpacker Reference;
+  Reference.UnpackBitsquidPackage(Reference.ReadSegmentCompressedFile(FileName), (GetWorkFolder() / "unpack").string());
+
+  return 0;
+}
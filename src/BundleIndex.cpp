@@ -0,0 +1,372 @@
+#include "BundleIndex.h"
+#include "HeaderCache.h"
+
+#include <zlib.h>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+  constexpr uint64_t BITSQUID_PACKAGE_HEADER_SIZE = 256;
+
+  struct Record
+  {
+    uint64_t TypeHash;
+    uint64_t NameHash;
+  };
+
+  struct ResourceData
+  {
+    int32_t  _;
+    uint32_t FileSize;
+    uint32_t StreamSize; // Size in the .stream file, not part of the bundle
+  };
+
+  // Segment cache owner ids, a new one on every Open
+  std::atomic<uint64_t> NextId{ 1 };
+}
+
+//
+// Interface
+//
+
+bool BundleIndex::Open(
+    const std::string & _FileName,
+    SegmentCache *      _Cache,
+    const HeaderCache * _Headers
+  )
+{
+  m_FileName = _FileName;
+  m_Cache    = _Cache;
+  m_Id       = NextId++;
+  m_Headers  = nullptr;
+
+  m_FromHeaderCache = false;
+
+  m_Segments.clear();
+  m_Resources.clear();
+  m_UncompressedSize = 0;
+
+  if (!m_File.Open(_FileName))
+    return false;
+
+  m_FileSize = m_File.GetSize();
+
+  if (_Headers)
+  {
+    // An entry that doesn't fit the file is ignored and the file scanned
+    if (const int64_t Entry = _Headers->Find(_FileName); Entry != HeaderCache::NOT_FOUND && ReadHeaderCache(*_Headers, Entry))
+    {
+      m_FromHeaderCache = true;
+      return true;
+    }
+
+    m_Segments.clear();
+    m_UncompressedSize = 0;
+  }
+
+  return ReadSegmentTable() && ReadRecordTable();
+}
+
+bool BundleIndex::Read(
+    uint64_t _Offset,
+    void *   _Destination,
+    uint64_t _Size
+  ) const
+{
+  if (_Offset > m_UncompressedSize || _Size > m_UncompressedSize - _Offset)
+    return false;
+
+  auto * Destination = static_cast<unsigned char *>(_Destination);
+
+  while (_Size > 0)
+  {
+    const uint32_t Index     = static_cast<uint32_t>(_Offset / SEGMENT_SIZE);
+    const uint64_t InSegment = _Offset % SEGMENT_SIZE;
+    const uint64_t Count     = std::min(_Size, SEGMENT_SIZE - InSegment);
+
+    if (IsStored(Index))
+    {
+      std::memcpy(Destination, m_File.GetData() + m_Segments[Index].Offset + InSegment, Count);
+    }
+    else
+    {
+      const SegmentCache::Segment Segment = InflateSegment(Index);
+
+      if (!Segment || Segment->size() < InSegment + Count)
+        return false;
+
+      std::memcpy(Destination, Segment->data() + InSegment, Count);
+    }
+
+    Destination += Count;
+    _Offset     += Count;
+    _Size       -= Count;
+  }
+
+  return true;
+}
+
+SegmentCache::Segment BundleIndex::InflateSegment(
+    uint32_t _Index
+  ) const
+{
+  if (_Index >= m_Segments.size())
+    return nullptr;
+
+  if (m_Cache)
+  {
+    if (SegmentCache::Segment Cached = m_Cache->Find(m_Id, _Index))
+      return Cached;
+  }
+
+  const Segment & Segment = m_Segments[_Index];
+  const Bytef *   Input   = m_File.GetData() + Segment.Offset;
+
+  auto Data = std::make_shared<std::vector<unsigned char>>(SEGMENT_SIZE);
+
+  if (IsStored(_Index))
+  {
+    std::memcpy(Data->data(), Input, SEGMENT_SIZE);
+  }
+  else
+  {
+    uLongf UncompressedSize = SEGMENT_SIZE;
+
+    if (!m_Inflated[_Index].exchange(true))
+      m_InflateCount++;
+
+    if (uncompress(Data->data(), &UncompressedSize, Input, Segment.CompressedSize) != Z_OK)
+      return nullptr;
+
+    // Only the last segment is allowed to be short, offsets rely on it
+    if (UncompressedSize != SEGMENT_SIZE && _Index + 1 != m_Segments.size())
+      return nullptr;
+
+    Data->resize(UncompressedSize);
+  }
+
+  if (m_Cache)
+    m_Cache->Insert(m_Id, _Index, Data);
+
+  return Data;
+}
+
+bool BundleIndex::IsStored(
+    uint32_t _Index
+  ) const
+{
+  return m_Segments[_Index].CompressedSize == SEGMENT_SIZE;
+}
+
+void BundleIndex::Close()
+{
+  m_File.Close();
+}
+
+bool BundleIndex::Reopen()
+{
+  // The tables describe the file as it was, a resized one no longer matches them
+  if (!m_File.Open(m_FileName) || m_File.GetSize() != m_FileSize)
+  {
+    m_File.Close();
+    return false;
+  }
+
+  return true;
+}
+
+bool BundleIndex::IsFromHeaderCache() const
+{
+  return m_FromHeaderCache;
+}
+
+const std::string & BundleIndex::GetFileName() const
+{
+  return m_FileName;
+}
+
+const MappedFile & BundleIndex::GetFile() const
+{
+  return m_File;
+}
+
+const std::vector<BundleIndex::Segment> & BundleIndex::GetSegments() const
+{
+  return m_Segments;
+}
+
+const std::vector<BundleIndex::Resource> & BundleIndex::GetResources() const
+{
+  std::lock_guard Lock(m_ResourcesMutex);
+
+  if (m_Headers)
+  {
+    m_Resources.resize(m_Headers->GetResourceCount(m_HeaderEntry));
+
+    for (size_t i = 0; i < m_Resources.size(); ++i)
+      m_Resources[i] = m_Headers->GetResource(m_HeaderEntry, i);
+
+    m_Headers = nullptr;
+  }
+
+  return m_Resources;
+}
+
+uint64_t BundleIndex::GetUncompressedSize() const
+{
+  return m_UncompressedSize;
+}
+
+uint64_t BundleIndex::GetInflateCount() const
+{
+  return m_InflateCount;
+}
+
+//
+// Service
+//
+
+bool BundleIndex::ReadSegmentTable()
+{
+  const unsigned char * Data     = m_File.GetData();
+  const uint64_t        FileSize = m_File.GetSize();
+
+  if (FileSize < HEADER_SIZE)
+    return false;
+
+  for (uint64_t Offset = HEADER_SIZE; Offset < FileSize; )
+  {
+    uint32_t CompressedSize = 0;
+
+    if (FileSize - Offset < sizeof(CompressedSize))
+      return false;
+
+    std::memcpy(&CompressedSize, Data + Offset, sizeof(CompressedSize));
+    Offset += sizeof(CompressedSize);
+
+    if (CompressedSize > SEGMENT_SIZE || CompressedSize > FileSize - Offset)
+      return false;
+
+    m_Segments.push_back(Segment{ Offset, CompressedSize });
+    Offset += CompressedSize;
+  }
+
+  m_Inflated = std::vector<std::atomic<bool>>(m_Segments.size());
+
+  if (m_Segments.empty())
+    return true;
+
+  // Every segment but the last one inflates to exactly SEGMENT_SIZE
+  const SegmentCache::Segment Last = InflateSegment(static_cast<uint32_t>(m_Segments.size() - 1));
+
+  if (!Last)
+    return false;
+
+  m_UncompressedSize = (m_Segments.size() - 1) * SEGMENT_SIZE + Last->size();
+
+  return true;
+}
+
+bool BundleIndex::ReadRecordTable()
+{
+  uint64_t Offset = 0;
+
+  const auto ReadBytes = [&](auto * _Destination) -> bool
+  {
+    const size_t Size = sizeof(std::decay_t<decltype(*_Destination)>);
+
+    if (!Read(Offset, _Destination, Size))
+      return false;
+
+    Offset += Size;
+
+    return true;
+  };
+
+  int32_t RecordsCount = 0;
+
+  if (!ReadBytes(&RecordsCount) || RecordsCount < 0)
+    return false;
+
+  Offset += BITSQUID_PACKAGE_HEADER_SIZE;
+
+  if (static_cast<uint64_t>(RecordsCount) * sizeof(Record) > m_UncompressedSize)
+    return false;
+
+  m_Resources.resize(RecordsCount);
+
+  for (Resource & Resource : m_Resources)
+  {
+    Record Item{};
+
+    if (!ReadBytes(&Item))
+      return false;
+
+    Resource.TypeHash = Item.TypeHash;
+    Resource.NameHash = Item.NameHash;
+  }
+
+  for (Resource & Resource : m_Resources)
+  {
+    Record  ResourceInfo{};
+    int64_t ChunkCount = 0;
+
+    if (!ReadBytes(&ResourceInfo) || !ReadBytes(&ChunkCount) || ChunkCount < 0)
+      return false;
+
+    Resource.Size = 0;
+
+    for (int64_t i = 0; i < ChunkCount; ++i)
+    {
+      ResourceData Chunk{};
+
+      if (!ReadBytes(&Chunk))
+        return false;
+
+      const uint64_t ChunkSize = Chunk.FileSize;
+
+      if (ChunkSize > m_UncompressedSize - Resource.Size)
+        return false;
+
+      Resource.Size += ChunkSize;
+    }
+
+    Resource.Offset = Offset;
+
+    if (Resource.Size > m_UncompressedSize - Offset)
+      return false;
+
+    Offset += Resource.Size;
+  }
+
+  return true;
+}
+
+bool BundleIndex::ReadHeaderCache(
+    const HeaderCache & _Headers,
+    int64_t             _Entry
+  )
+{
+  m_UncompressedSize = _Headers.GetUncompressedSize(_Entry);
+  m_Segments.resize(_Headers.GetSegmentCount(_Entry));
+  m_Inflated = std::vector<std::atomic<bool>>(m_Segments.size());
+
+  for (size_t i = 0; i < m_Segments.size(); ++i)
+  {
+    // Size and mtime matched, still never trust offsets outside the mapping
+    if (!_Headers.GetSegment(_Entry, i, m_Segments[i]) || m_Segments[i].Offset > m_File.GetSize() ||
+        m_Segments[i].CompressedSize > m_File.GetSize() - m_Segments[i].Offset)
+    {
+      return false;
+    }
+  }
+
+  if (m_UncompressedSize > m_Segments.size() * SEGMENT_SIZE)
+    return false;
+
+  m_Headers     = &_Headers;
+  m_HeaderEntry = _Entry;
+
+  return true;
+}
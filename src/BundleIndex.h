@@ -0,0 +1,115 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+
+#include "MappedFile.h"
+#include "SegmentCache.h"
+
+class HeaderCache;
+
+// Random access view of a segment compressed bundle. Keeps the file mapped,
+// knows where every segment starts and where every resource lives in the
+// inflated package, and only inflates the segments a read actually touches.
+class BundleIndex
+{
+public: // Constants
+
+  static constexpr uint64_t HEADER_SIZE  = 12;
+  static constexpr uint64_t SEGMENT_SIZE = 65536;
+
+public: // Types
+
+  struct Segment
+  {
+    uint64_t Offset;         // Payload position in the bundle file
+    uint32_t CompressedSize; // SEGMENT_SIZE means the payload is stored as is
+  };
+
+  struct Resource
+  {
+    uint64_t TypeHash;
+    uint64_t NameHash;
+    uint64_t Offset;         // Position of the first chunk in the inflated package
+    uint64_t Size;           // All chunks, they are laid out back to back
+  };
+
+public: // Interface
+
+  // With _Headers holding a valid entry for the file, nothing is scanned or
+  // inflated and the records are only read on the first GetResources call
+  bool Open(
+      const std::string & _FileName,
+      SegmentCache *      _Cache = nullptr,
+      const HeaderCache * _Headers = nullptr
+    );
+
+  bool Read(
+      uint64_t _Offset,
+      void *   _Destination,
+      uint64_t _Size
+    ) const;
+
+  SegmentCache::Segment InflateSegment(
+      uint32_t _Index
+    ) const;
+
+  bool IsStored(
+      uint32_t _Index
+    ) const;
+
+  // Unmaps the file, only the segment and record tables stay usable
+  void Close();
+
+  // Maps the file of a closed index again, as long as its size is unchanged
+  bool Reopen();
+
+  // Whether Open took the tables from a header cache instead of the file
+  bool IsFromHeaderCache() const;
+
+  const std::string & GetFileName() const;
+
+  const MappedFile & GetFile() const;
+
+  const std::vector<Segment> & GetSegments() const;
+
+  const std::vector<Resource> & GetResources() const;
+
+  uint64_t GetUncompressedSize() const;
+
+  // Distinct segments inflated so far, cache hits and stored segments excluded
+  uint64_t GetInflateCount() const;
+
+protected: // Service
+
+  bool ReadSegmentTable();
+
+  bool ReadRecordTable();
+
+  bool ReadHeaderCache(
+      const HeaderCache & _Headers,
+      int64_t             _Entry
+    );
+
+protected: // Members
+
+  std::string                   m_FileName;
+  MappedFile                    m_File;
+  uint64_t                      m_FileSize = 0;
+  SegmentCache *                m_Cache = nullptr;
+  uint64_t                      m_Id = 0; // Key of this bundle's segments in m_Cache
+  std::vector<Segment>          m_Segments;
+  mutable std::vector<Resource> m_Resources;
+  uint64_t                      m_UncompressedSize = 0;
+
+  // Set while the records still live in the header cache only
+  mutable std::mutex            m_ResourcesMutex;
+  mutable const HeaderCache *   m_Headers = nullptr;
+  int64_t                       m_HeaderEntry = 0;
+  bool                          m_FromHeaderCache = false;
+
+  mutable std::vector<std::atomic<bool>> m_Inflated; // Per segment, so re-inflating one isn't counted twice
+  mutable std::atomic<uint64_t>          m_InflateCount{ 0 };
+};
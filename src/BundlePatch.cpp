@@ -0,0 +1,460 @@
+#include "BundlePatch.h"
+
+#include <zlib.h>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <map>
+#include <limits>
+#include <filesystem>
+
+#include "MurmurHash2/MurmurHash2.h"
+#include "MappedFile.h"
+#include "SegmentCache.h"
+#include "SegmentedFile.h"
+
+namespace
+{
+  constexpr char     PATCH_MAGIC[4] = { 'M', 'U', 'P', 'T' };
+  constexpr uint32_t PATCH_VERSION  = 2;
+
+  // Plan entry for segments that have to be deflated again
+  constexpr int64_t  ENCODE_SEGMENT = -1;
+
+  // Deflate never expands data by more than about 1032:1
+  constexpr uint64_t DEFLATE_MAX_RATIO = 1032;
+
+  uint64_t HashBytes(const unsigned char * _Data, uint64_t _Size)
+  {
+    // MurmurHash64A takes an int length, chain the seed through 1 GiB blocks
+    uint64_t Hash = 0;
+
+    for (uint64_t Offset = 0; Offset < _Size; Offset += 1ull << 30)
+      Hash = MurmurHash64A(_Data + Offset, static_cast<int>(std::min<uint64_t>(_Size - Offset, 1ull << 30)), Hash);
+
+    return Hash;
+  }
+
+  // Hash of an inflated package, chained through its segments in order
+  void HashSegment(uint64_t & _Hash, const unsigned char * _Data, uint64_t _Size)
+  {
+    _Hash = MurmurHash64A(_Data, static_cast<int>(_Size), _Hash);
+  }
+
+  bool FitsULong(uint64_t _Value)
+  {
+    return _Value <= std::numeric_limits<uLong>::max();
+  }
+}
+
+//
+// Interface
+//
+
+bool BundlePatch::Create(
+    const std::string & _OldBundle,
+    const std::string & _NewBundle,
+    const std::string & _PatchFile
+  )
+{
+  SegmentCache Cache;
+  BundleIndex  Old;
+  BundleIndex  New;
+
+  if (!Old.Open(_OldBundle, &Cache) || !New.Open(_NewBundle, &Cache))
+    return false;
+
+  m_Extents.clear();
+  m_Literals.clear();
+
+  std::vector<unsigned char> Buffer;
+  std::vector<unsigned char> OldBuffer;
+
+  // Old payloads by content, so moved and renamed resources are found too
+  std::map<std::pair<uint64_t, uint64_t>, uint64_t> OldPayloads;
+
+  for (const auto & Resource : Old.GetResources())
+  {
+    Buffer.resize(Resource.Size);
+
+    if (!Old.Read(Resource.Offset, Buffer.data(), Resource.Size))
+      return false;
+
+    OldPayloads.try_emplace(std::pair{ HashBytes(Buffer.data(), Buffer.size()), Resource.Size }, Resource.Offset);
+  }
+
+  const auto MatchesOld = [&](uint64_t _OldOffset) -> bool
+  {
+    if (_OldOffset > Old.GetUncompressedSize() || Buffer.size() > Old.GetUncompressedSize() - _OldOffset)
+      return false;
+
+    OldBuffer.resize(Buffer.size());
+
+    return Old.Read(_OldOffset, OldBuffer.data(), OldBuffer.size()) && OldBuffer == Buffer;
+  };
+
+  const auto AddRange = [&](uint64_t _Offset, uint64_t _Length, bool _IsPayload) -> bool
+  {
+    if (_Length == 0)
+      return true;
+
+    Buffer.resize(_Length);
+
+    if (!New.Read(_Offset, Buffer.data(), _Length))
+      return false;
+
+    // Unchanged bytes usually continue the old run they follow, this also
+    // catches the record table and chunk headers between payloads
+    const uint64_t Continuation = m_Extents.empty() ? 0 : m_Extents.back().Source + m_Extents.back().Length;
+
+    if ((m_Extents.empty() || m_Extents.back().Kind == CopyOld) && MatchesOld(Continuation))
+    {
+      AddExtent(CopyOld, Continuation, _Length);
+      return true;
+    }
+
+    if (_IsPayload)
+    {
+      const auto it = OldPayloads.find(std::pair{ HashBytes(Buffer.data(), Buffer.size()), _Length });
+
+      if (it != OldPayloads.end() && MatchesOld(it->second))
+      {
+        AddExtent(CopyOld, it->second, _Length);
+        return true;
+      }
+    }
+
+    AddExtent(CopyLiteral, m_Literals.size(), _Length);
+    m_Literals.insert(m_Literals.end(), Buffer.begin(), Buffer.end());
+
+    return true;
+  };
+
+  uint64_t Offset = 0;
+
+  for (const auto & Resource : New.GetResources())
+  {
+    if (!AddRange(Offset, Resource.Offset - Offset, false) ||
+        !AddRange(Resource.Offset, Resource.Size, true))
+    {
+      return false;
+    }
+
+    Offset = Resource.Offset + Resource.Size;
+  }
+
+  if (!AddRange(Offset, New.GetUncompressedSize() - Offset, false))
+    return false;
+
+  // Segments that are an aligned, equally long run of the old package keep
+  // their old compressed bytes
+  const uint64_t NewSize = New.GetUncompressedSize();
+  const uint64_t OldSize = Old.GetUncompressedSize();
+
+  std::vector<int64_t> SegmentPlan;
+  size_t               ExtentIndex = 0;
+
+  for (uint64_t Begin = 0; Begin < NewSize; Begin += BundleIndex::SEGMENT_SIZE)
+  {
+    const uint64_t End = std::min(Begin + BundleIndex::SEGMENT_SIZE, NewSize);
+
+    while (m_Extents[ExtentIndex].NewOffset + m_Extents[ExtentIndex].Length <= Begin)
+      ++ExtentIndex;
+
+    const Extent & Extent = m_Extents[ExtentIndex];
+    int64_t        Plan   = ENCODE_SEGMENT;
+
+    if (Extent.Kind == CopyOld && Extent.NewOffset + Extent.Length >= End)
+    {
+      const uint64_t OldBegin = Extent.Source + (Begin - Extent.NewOffset);
+      const uint64_t OldEnd   = std::min(OldBegin + BundleIndex::SEGMENT_SIZE, OldSize);
+
+      if (OldBegin % BundleIndex::SEGMENT_SIZE == 0 && OldEnd - OldBegin == End - Begin)
+        Plan = static_cast<int64_t>(OldBegin / BundleIndex::SEGMENT_SIZE);
+    }
+
+    SegmentPlan.push_back(Plan);
+  }
+
+  uint64_t PackageHash = 0;
+
+  Buffer.resize(BundleIndex::SEGMENT_SIZE);
+
+  for (uint64_t Begin = 0; Begin < NewSize; Begin += BundleIndex::SEGMENT_SIZE)
+  {
+    const uint64_t Size = std::min<uint64_t>(BundleIndex::SEGMENT_SIZE, NewSize - Begin);
+
+    if (!New.Read(Begin, Buffer.data(), Size))
+      return false;
+
+    HashSegment(PackageHash, Buffer.data(), Size);
+  }
+
+  if (!FitsULong(m_Literals.size()))
+  {
+    std::cerr << "Too many changed bytes for one patch" << std::endl;
+    return false;
+  }
+
+  uLongf                     CompressedSize = compressBound(static_cast<uLong>(m_Literals.size()));
+  std::vector<unsigned char> Compressed(CompressedSize);
+
+  if (compress2(Compressed.data(), &CompressedSize, m_Literals.data(), static_cast<uLong>(m_Literals.size()), Z_BEST_COMPRESSION) != Z_OK)
+    return false;
+
+  std::ofstream PatchFile(_PatchFile, std::ios::binary);
+
+  const auto WriteValue = [&](const auto & _Value)
+  {
+    PatchFile.write(reinterpret_cast<const char *>(&_Value), sizeof(_Value));
+  };
+
+  PatchFile.write(PATCH_MAGIC, sizeof(PATCH_MAGIC));
+  WriteValue(PATCH_VERSION);
+
+  // The new bundle header is carried over verbatim
+  PatchFile.write(reinterpret_cast<const char *>(New.GetFile().GetData()), BundleIndex::HEADER_SIZE);
+
+  WriteValue(static_cast<uint64_t>(Old.GetFile().GetSize()));
+  WriteValue(HashBytes(Old.GetFile().GetData(), Old.GetFile().GetSize()));
+  WriteValue(PackageHash);
+
+  WriteValue(NewSize);
+  WriteValue(static_cast<uint64_t>(m_Extents.size()));
+  WriteValue(static_cast<uint64_t>(SegmentPlan.size()));
+  WriteValue(static_cast<uint64_t>(m_Literals.size()));
+  WriteValue(static_cast<uint64_t>(CompressedSize));
+
+  for (const auto & Extent : m_Extents)
+  {
+    WriteValue(Extent.Length);
+    WriteValue(Extent.Source);
+    WriteValue(Extent.Kind);
+  }
+
+  for (const int64_t Plan : SegmentPlan)
+    WriteValue(Plan);
+
+  PatchFile.write(reinterpret_cast<const char *>(Compressed.data()), CompressedSize);
+
+  const auto Reused = std::count_if(SegmentPlan.begin(), SegmentPlan.end(), [](int64_t _Plan) { return _Plan != ENCODE_SEGMENT; });
+
+  std::cout << m_Extents.size() << " extents, " << m_Literals.size() << " literal bytes, "
+            << Reused << " of " << SegmentPlan.size() << " segments reused" << std::endl;
+
+  return PatchFile.good();
+}
+
+bool BundlePatch::Apply(
+    const std::string & _OldBundle,
+    const std::string & _PatchFile,
+    const std::string & _NewBundle
+  )
+{
+  SegmentCache Cache(64ull * 1024 * 1024);
+  BundleIndex  Old;
+  MappedFile   Patch;
+
+  if (!Old.Open(_OldBundle, &Cache) || !Patch.Open(_PatchFile))
+    return false;
+
+  const unsigned char * PatchData = Patch.GetData();
+  uint64_t              Offset    = 0;
+
+  const auto ReadValue = [&](auto & _Value) -> bool
+  {
+    if (Patch.GetSize() - Offset < sizeof(_Value))
+      return false;
+
+    std::memcpy(&_Value, PatchData + Offset, sizeof(_Value));
+    Offset += sizeof(_Value);
+
+    return true;
+  };
+
+  char     Magic[4];
+  uint32_t Version = 0;
+  uint32_t BundleHeader[3];
+  uint64_t OldFileSize = 0;
+  uint64_t OldHash = 0;
+  uint64_t PackageHash = 0;
+  uint64_t NewSize = 0;
+  uint64_t ExtentCount = 0;
+  uint64_t SegmentCount = 0;
+  uint64_t LiteralSize = 0;
+  uint64_t CompressedSize = 0;
+
+  if (!ReadValue(Magic) || std::memcmp(Magic, PATCH_MAGIC, sizeof(Magic)) != 0 ||
+      !ReadValue(Version) || Version != PATCH_VERSION ||
+      !ReadValue(BundleHeader) || !ReadValue(OldFileSize) || !ReadValue(OldHash) || !ReadValue(PackageHash) ||
+      !ReadValue(NewSize) || !ReadValue(ExtentCount) || !ReadValue(SegmentCount) ||
+      !ReadValue(LiteralSize) || !ReadValue(CompressedSize))
+  {
+    return false;
+  }
+
+  if (Old.GetFile().GetSize() != OldFileSize || HashBytes(Old.GetFile().GetData(), Old.GetFile().GetSize()) != OldHash)
+  {
+    std::cerr << _PatchFile << " was not made from " << _OldBundle << std::endl;
+    return false;
+  }
+
+  if (LiteralSize > NewSize || !FitsULong(LiteralSize) || !FitsULong(CompressedSize) ||
+      SegmentCount != (NewSize + BundleIndex::SEGMENT_SIZE - 1) / BundleIndex::SEGMENT_SIZE)
+  {
+    return false;
+  }
+
+  m_Extents.clear();
+
+  for (uint64_t i = 0; i < ExtentCount; ++i)
+  {
+    Extent Item{};
+
+    if (!ReadValue(Item.Length) || !ReadValue(Item.Source) || !ReadValue(Item.Kind))
+      return false;
+
+    const uint64_t SourceSize = Item.Kind == CopyOld ? Old.GetUncompressedSize() : LiteralSize;
+
+    if (Item.Kind > CopyLiteral || Item.Source > SourceSize || Item.Length > SourceSize - Item.Source)
+      return false;
+
+    AddExtent(Item.Kind, Item.Source, Item.Length);
+  }
+
+  if (m_Extents.empty() ? NewSize != 0 : m_Extents.back().NewOffset + m_Extents.back().Length != NewSize)
+    return false;
+
+  // Forged counts and sizes must not get to allocate, bound them by the patch bytes
+  if (SegmentCount > (Patch.GetSize() - Offset) / sizeof(int64_t))
+    return false;
+
+  std::vector<int64_t> SegmentPlan(SegmentCount);
+
+  for (int64_t & Plan : SegmentPlan)
+  {
+    if (!ReadValue(Plan) || Plan < ENCODE_SEGMENT || Plan >= static_cast<int64_t>(Old.GetSegments().size()))
+      return false;
+  }
+
+  if (Patch.GetSize() - Offset < CompressedSize || LiteralSize > CompressedSize * DEFLATE_MAX_RATIO)
+    return false;
+
+  uLongf LiteralsSize = static_cast<uLongf>(LiteralSize);
+  m_Literals.resize(LiteralSize);
+
+  if (uncompress(m_Literals.data(), &LiteralsSize, PatchData + Offset, static_cast<uLong>(CompressedSize)) != Z_OK || LiteralsSize != LiteralSize)
+    return false;
+
+  // Written next to the output and only renamed into place once verified
+  const std::string TemporaryName = _NewBundle + ".tmp";
+  std::ofstream     Bundle(TemporaryName, std::ios::binary);
+
+  const auto Discard = [&]() -> bool
+  {
+    Bundle.close();
+    std::remove(TemporaryName.c_str());
+
+    return false;
+  };
+
+  Bundle.write(reinterpret_cast<const char *>(BundleHeader), sizeof(BundleHeader));
+
+  std::vector<unsigned char> Segment(BundleIndex::SEGMENT_SIZE);
+  std::vector<unsigned char> Buffer(SegmentedFile::ENCODED_SEGMENT_MAX_SIZE);
+  uint64_t                   Hash = 0;
+
+  for (uint64_t Index = 0; Index < SegmentCount; ++Index)
+  {
+    const uint64_t Begin = Index * BundleIndex::SEGMENT_SIZE;
+    const uint64_t End   = std::min(Begin + BundleIndex::SEGMENT_SIZE, NewSize);
+
+    // Reused segments are a plain copy of the old compressed bytes
+    if (SegmentPlan[Index] != ENCODE_SEGMENT)
+    {
+      const BundleIndex::Segment & OldSegment = Old.GetSegments()[SegmentPlan[Index]];
+
+      if (!Old.Read(static_cast<uint64_t>(SegmentPlan[Index]) * BundleIndex::SEGMENT_SIZE, Segment.data(), End - Begin))
+        return Discard();
+
+      HashSegment(Hash, Segment.data(), End - Begin);
+
+      Bundle.write(reinterpret_cast<const char *>(&OldSegment.CompressedSize), sizeof(OldSegment.CompressedSize));
+      Bundle.write(reinterpret_cast<const char *>(Old.GetFile().GetData() + OldSegment.Offset), OldSegment.CompressedSize);
+
+      continue;
+    }
+
+    auto it = std::upper_bound(m_Extents.begin(), m_Extents.end(), Begin, [](uint64_t _Offset, const Extent & _Extent)
+    {
+      return _Offset < _Extent.NewOffset;
+    });
+
+    for (uint64_t Position = Begin; Position < End; ++it)
+    {
+      const Extent & Extent = *std::prev(it);
+
+      const uint64_t InExtent = Position - Extent.NewOffset;
+      const uint64_t Count    = std::min(End - Position, Extent.Length - InExtent);
+
+      unsigned char * Destination = Segment.data() + (Position - Begin);
+
+      if (Extent.Kind == CopyLiteral)
+        std::memcpy(Destination, m_Literals.data() + Extent.Source + InExtent, Count);
+      else if (!Old.Read(Extent.Source + InExtent, Destination, Count))
+        return Discard();
+
+      Position += Count;
+    }
+
+    HashSegment(Hash, Segment.data(), End - Begin);
+
+    const uint32_t Size = SegmentedFile::EncodeSegment(Segment.data(), static_cast<uint32_t>(End - Begin), Buffer.data());
+
+    Bundle.write(reinterpret_cast<const char *>(Buffer.data()), Size);
+  }
+
+  Bundle.close();
+
+  if (!Bundle)
+    return Discard();
+
+  if (Hash != PackageHash)
+  {
+    std::cerr << "Patched package of " << _NewBundle << " does not match the one the patch was made for" << std::endl;
+    return Discard();
+  }
+
+  std::error_code Error;
+  std::filesystem::rename(TemporaryName, _NewBundle, Error);
+
+  return Error ? Discard() : true;
+}
+
+//
+// Service
+//
+
+void BundlePatch::AddExtent(
+    uint32_t _Kind,
+    uint64_t _Source,
+    uint64_t _Length
+  )
+{
+  if (!m_Extents.empty())
+  {
+    Extent & Last = m_Extents.back();
+
+    if (Last.Kind == _Kind && Last.Source + Last.Length == _Source)
+    {
+      Last.Length += _Length;
+      return;
+    }
+  }
+
+  const uint64_t NewOffset = m_Extents.empty() ? 0 : m_Extents.back().NewOffset + m_Extents.back().Length;
+
+  m_Extents.push_back(Extent{ NewOffset, _Length, _Source, _Kind });
+}
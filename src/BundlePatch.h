@@ -0,0 +1,65 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "BundleIndex.h"
+
+// Resource level delta between two versions of a bundle.
+//
+// The new inflated package is described as extents that are either copied
+// from the old package or taken from the patch's own (deflated) literal
+// bytes. Segments of the new bundle whose bytes are an aligned run of the
+// old package reuse the old compressed segment as is, everything else is
+// deflated again while applying, the way SegmentedFile packs it. The result
+// is byte identical to the new bundle when that was packed by this tool with
+// the same zlib, otherwise it holds the same package in different segments.
+//
+// The patch records the size and hash of the old bundle and a hash of the
+// new package, Apply refuses other old bundles and only renames its output
+// into place once the package hash matches.
+class BundlePatch
+{
+public: // Interface
+
+  bool Create(
+      const std::string & _OldBundle,
+      const std::string & _NewBundle,
+      const std::string & _PatchFile
+    );
+
+  bool Apply(
+      const std::string & _OldBundle,
+      const std::string & _PatchFile,
+      const std::string & _NewBundle
+    );
+
+protected: // Types
+
+  enum ExtentKind : uint32_t
+  {
+    CopyOld,
+    CopyLiteral
+  };
+
+  struct Extent
+  {
+    uint64_t NewOffset;
+    uint64_t Length;
+    uint64_t Source; // Offset in the old package or in the literal bytes
+    uint32_t Kind;
+  };
+
+protected: // Service
+
+  void AddExtent(
+      uint32_t _Kind,
+      uint64_t _Source,
+      uint64_t _Length
+    );
+
+protected: // Members
+
+  std::vector<Extent>        m_Extents;
+  std::vector<unsigned char> m_Literals;
+};
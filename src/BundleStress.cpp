@@ -0,0 +1,665 @@
+#include "BundleStress.h"
+
+#include <zlib.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <climits>
+
+#include "SegmentedFile.h"
+#include "SegmentedFileDecompressor.h"
+#include "BundleIndex.h"
+#include "HeaderCache.h"
+#include "PackageParser.h"
+#include "ResourceFilter.h"
+#include "BundlePatch.h"
+
+namespace
+{
+  constexpr uint64_t SEGMENT_SIZE                 = 65536;
+  constexpr uint64_t BITSQUID_PACKAGE_HEADER_SIZE = 256;
+
+  constexpr std::pair<const char *, BundleStress::Shape> SHAPE_NAMES[] =
+  {
+    { "many-records",  BundleStress::Shape::ManyRecords  },
+    { "full-segments", BundleStress::Shape::FullSegments },
+    { "many-chunks",   BundleStress::Shape::ManyChunks   },
+    { "stream-sizes",  BundleStress::Shape::StreamSizes  },
+    { "truncated",     BundleStress::Shape::Truncated    },
+    { "mutated",       BundleStress::Shape::Mutated      },
+  };
+
+  // Protected parsers of the unpackers, exposed to be driven directly
+  class ReferenceUnpacker : public SegmentedFile
+  {
+  public:
+
+    using SegmentedFile::ReadSegmentCompressedFile;
+    using SegmentedFile::UnpackBitsquidPackage;
+  };
+
+  class FastUnpacker : public SegmentedFileDecompressor
+  {
+  public:
+
+    using SegmentedFileDecompressor::PackageBuffer;
+    using SegmentedFileDecompressor::ReadSegmentCompressedFile;
+    using SegmentedFileDecompressor::UnpackBitsquidPackage;
+    using SegmentedFileDecompressor::BuildOutputFileName;
+  };
+
+  template <typename T>
+  void Append(std::vector<unsigned char> & _Data, const T & _Value)
+  {
+    const auto * Bytes = reinterpret_cast<const unsigned char *>(&_Value);
+    _Data.insert(_Data.end(), Bytes, Bytes + sizeof(T));
+  }
+
+  template <typename T>
+  void Overwrite(std::vector<unsigned char> & _Data, uint64_t _Offset, const T & _Value)
+  {
+    if (_Offset + sizeof(T) <= _Data.size())
+      std::memcpy(_Data.data() + _Offset, &_Value, sizeof(T));
+  }
+
+  template <typename Left, typename Right>
+  bool SameResources(const std::vector<Left> & _Left, const std::vector<Right> & _Right)
+  {
+    return std::equal(_Left.begin(), _Left.end(), _Right.begin(), _Right.end(), [](const auto & lhs, const auto & rhs)
+    {
+      return lhs.TypeHash == rhs.TypeHash && lhs.NameHash == rhs.NameHash && lhs.Offset == rhs.Offset && lhs.Size == rhs.Size;
+    });
+  }
+
+  // Folder unpackers and the patcher report progress, keep the report readable
+  template <typename Function>
+  void Quietly(Function && _Function)
+  {
+    std::streambuf * Out   = std::cout.rdbuf(nullptr);
+    std::streambuf * Error = std::cerr.rdbuf(nullptr);
+
+    _Function();
+
+    std::cout.rdbuf(Out);
+    std::cerr.rdbuf(Error);
+  }
+
+  template <typename Function>
+  double Measure(Function && _Function)
+  {
+    const auto Start = std::chrono::steady_clock::now();
+    _Function();
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+  }
+}
+
+//
+// Interface
+//
+
+bool BundleStress::Run(
+    const std::string & _Shape,
+    const std::string & _WorkFolder,
+    const Options &     _Options
+  )
+{
+  m_Options  = _Options;
+  m_Failures = 0;
+
+  std::error_code Error;
+  std::filesystem::create_directories(_WorkFolder + "/bundles", Error);
+  std::filesystem::create_directories(_WorkFolder + "/reference", Error);
+  std::filesystem::create_directories(_WorkFolder + "/unpack", Error);
+
+  bool Known = false;
+
+  for (const auto & [Name, Shape] : SHAPE_NAMES)
+  {
+    if (_Shape != "all" && _Shape != Name)
+      continue;
+
+    Known = true;
+    m_Timings.clear();
+
+    uint64_t Records = 0;
+    uint64_t Bytes   = 0;
+
+    for (uint32_t Iteration = 0; Iteration < m_Options.Iterations; ++Iteration)
+    {
+      // Every iteration can be replayed alone with --seed=<Seed> --iterations=1
+      const uint64_t Seed = m_Options.Seed + Iteration;
+      m_Random.seed(Seed);
+
+      Bundle Item;
+      Generate(Shape, Item);
+      Corrupt(Shape, Item);
+
+      Records += Item.Resources.size();
+      Bytes   += Item.File.size();
+
+      if (!Verify(Item, _WorkFolder))
+        std::cerr << Name << ": failed with seed " << Seed << std::endl;
+    }
+
+    std::cout << Name << ": " << m_Options.Iterations << " bundles, " << Records << " records, " << Bytes << " bytes" << std::endl;
+
+    for (const auto & Timing : m_Timings)
+    {
+      std::cout << "  " << std::left << std::setw(20) << Timing.Name << std::right << std::fixed << std::setprecision(1)
+                << std::setw(10) << (Timing.Seconds > 0 ? Timing.Bytes / Timing.Seconds / (1024 * 1024) : 0) << " MiB/s"
+                << std::setw(10) << Timing.Seconds * 1000 << " ms" << std::endl;
+    }
+  }
+
+  if (!Known)
+  {
+    std::cerr << "Unknown shape " << _Shape << std::endl;
+    return false;
+  }
+
+  std::cout << m_Failures << " mismatches" << std::endl;
+
+  return m_Failures == 0;
+}
+
+//
+// Service
+//
+
+void BundleStress::Generate(
+    Shape    _Shape,
+    Bundle & _Bundle
+  )
+{
+  constexpr uint64_t TypeHashes[] = { 0xA14E8DFA2CD117E2, 0x92D3EE038EEB610D, 0x3359590304121595, 0x6AB4A5AF4C8E0D2B };
+
+  const auto Pick = [&](uint64_t _Count) { return m_Random() % _Count; };
+
+  switch (_Shape)
+  {
+  case Shape::ManyRecords:
+    for (uint32_t i = 0; i < m_Options.Records; ++i)
+      AddResource(_Bundle, TypeHashes[Pick(4)], i + 1, { Pick(17) }, true);
+    break;
+
+  case Shape::FullSegments:
+    for (uint32_t i = 0; i < 64; ++i)
+      AddResource(_Bundle, TypeHashes[Pick(4)], i + 1, std::vector<uint64_t>(1 + Pick(4), SEGMENT_SIZE), false);
+    break;
+
+  case Shape::StreamSizes:
+    _Bundle.StreamSize = static_cast<uint32_t>(1 + Pick(UINT32_MAX));
+    [[fallthrough]];
+
+  case Shape::ManyChunks:
+  case Shape::Truncated:
+  case Shape::Mutated:
+  {
+    const uint64_t ChunkSizes[] = { 0, 1, SEGMENT_SIZE - 1, SEGMENT_SIZE, SEGMENT_SIZE + 1 };
+    const uint32_t Count        = _Shape == Shape::ManyChunks ? 128 : 32;
+
+    for (uint32_t i = 0; i < Count; ++i)
+    {
+      std::vector<uint64_t> Chunks(1 + Pick(_Shape == Shape::ManyChunks ? 16 : 8));
+
+      for (auto & Chunk : Chunks)
+        Chunk = Pick(4) == 0 ? Pick(3 * SEGMENT_SIZE) : ChunkSizes[Pick(std::size(ChunkSizes))];
+
+      AddResource(_Bundle, TypeHashes[Pick(4)], i + 1, Chunks, Pick(2) == 0);
+    }
+    break;
+  }
+  }
+
+  BuildPackage(_Bundle);
+}
+
+void BundleStress::AddResource(
+    Bundle &                      _Bundle,
+    uint64_t                      _TypeHash,
+    uint64_t                      _NameHash,
+    const std::vector<uint64_t> & _Chunks,
+    bool                          _Compressible
+  )
+{
+  uint64_t Size = 0;
+
+  for (const uint64_t Chunk : _Chunks)
+    Size += Chunk;
+
+  const uint64_t Offset = _Bundle.Payloads.size();
+  _Bundle.Payloads.resize(Offset + Size);
+
+  for (uint64_t i = 0; i < Size; ++i)
+    _Bundle.Payloads[Offset + i] = _Compressible ? static_cast<unsigned char>(_NameHash + i / 64) : static_cast<unsigned char>(m_Random());
+
+  _Bundle.Resources.push_back(Resource{ _TypeHash, _NameHash, Offset, Size });
+  _Bundle.Chunks.push_back(_Chunks);
+}
+
+void BundleStress::BuildPackage(
+    Bundle & _Bundle
+  )
+{
+  std::vector<unsigned char> & Package = _Bundle.Package;
+
+  Append(Package, static_cast<int32_t>(_Bundle.Resources.size()));
+  Package.resize(Package.size() + BITSQUID_PACKAGE_HEADER_SIZE);
+
+  for (const auto & Resource : _Bundle.Resources)
+  {
+    Append(Package, Resource.TypeHash);
+    Append(Package, Resource.NameHash);
+  }
+
+  for (size_t i = 0; i < _Bundle.Resources.size(); ++i)
+  {
+    Resource & Resource = _Bundle.Resources[i];
+
+    Append(Package, Resource.TypeHash);
+    Append(Package, Resource.NameHash);
+
+    _Bundle.ChunkCountOffsets.push_back(Package.size());
+    Append(Package, static_cast<int64_t>(_Bundle.Chunks[i].size()));
+
+    for (const uint64_t Chunk : _Bundle.Chunks[i])
+    {
+      Append(Package, int32_t(0));
+      Append(Package, static_cast<uint32_t>(Chunk));
+      Append(Package, _Bundle.StreamSize);
+    }
+
+    const auto Payload = _Bundle.Payloads.begin() + Resource.Offset;
+
+    Resource.Offset = Package.size();
+    Package.insert(Package.end(), Payload, Payload + Resource.Size);
+  }
+}
+
+void BundleStress::Corrupt(
+    Shape    _Shape,
+    Bundle & _Bundle
+  )
+{
+  const auto Pick = [&](uint64_t _Count) { return m_Random() % _Count; };
+
+  // Forged counts and sizes go into the package so they survive the segment layer
+  if (_Shape == Shape::Mutated && Pick(2) == 0)
+  {
+    const uint64_t Resource = Pick(_Bundle.ChunkCountOffsets.size());
+
+    switch (Pick(4))
+    {
+    case 0:
+      Overwrite(_Bundle.Package, 0, Pick(2) == 0 ? INT32_MAX : -1);
+      break;
+    case 1:
+      Overwrite(_Bundle.Package, 0, static_cast<int32_t>(_Bundle.Resources.size() + 1));
+      break;
+    case 2:
+      Overwrite(_Bundle.Package, _Bundle.ChunkCountOffsets[Resource], Pick(2) == 0 ? INT64_MAX : int64_t(1) << 40);
+      break;
+    case 3:
+      // Size of the first chunk
+      Overwrite(_Bundle.Package, _Bundle.ChunkCountOffsets[Resource] + sizeof(int64_t) + 4, UINT32_MAX);
+      break;
+    }
+
+    _Bundle.Valid = false;
+  }
+
+  CompressSegments(_Bundle);
+
+  if (_Shape == Shape::Truncated)
+  {
+    _Bundle.File.resize(Pick(_Bundle.File.size()));
+    _Bundle.Valid = false;
+  }
+
+  if (_Shape == Shape::Mutated)
+  {
+    if (Pick(2) == 0 && !_Bundle.SegmentSizeOffsets.empty())
+    {
+      const uint32_t Sizes[] = { 0, 1, static_cast<uint32_t>(SEGMENT_SIZE), static_cast<uint32_t>(SEGMENT_SIZE + 1), UINT32_MAX };
+      Overwrite(_Bundle.File, _Bundle.SegmentSizeOffsets[Pick(_Bundle.SegmentSizeOffsets.size())], Sizes[Pick(std::size(Sizes))]);
+    }
+    else
+    {
+      for (uint64_t i = 1 + Pick(8); i > 0; --i)
+        _Bundle.File[Pick(_Bundle.File.size())] ^= static_cast<unsigned char>(1 + Pick(255));
+    }
+
+    _Bundle.Valid = false;
+  }
+}
+
+void BundleStress::CompressSegments(
+    Bundle & _Bundle
+  )
+{
+  const std::vector<unsigned char> & Package = _Bundle.Package;
+  std::vector<unsigned char> &       File    = _Bundle.File;
+
+  Append(File, uint32_t(0xF0000004));
+  Append(File, static_cast<uint32_t>(Package.size()));
+  Append(File, static_cast<uint32_t>(static_cast<uint64_t>(Package.size()) >> 32));
+
+  std::vector<unsigned char> Segment(SEGMENT_SIZE);
+  std::vector<unsigned char> Buffer(compressBound(SEGMENT_SIZE));
+
+  for (uint64_t Offset = 0; Offset < Package.size(); Offset += SEGMENT_SIZE)
+  {
+    const uint64_t Size = std::min(SEGMENT_SIZE, Package.size() - Offset);
+    uLongf CompressedSize = Buffer.size();
+
+    compress2(Buffer.data(), &CompressedSize, Package.data() + Offset, Size, 1);
+
+    _Bundle.SegmentSizeOffsets.push_back(File.size());
+
+    // Stored segments are always full, a short one is zero padded
+    if (CompressedSize >= SEGMENT_SIZE)
+    {
+      std::fill(Segment.begin(), Segment.end(), 0);
+      std::copy(Package.begin() + Offset, Package.begin() + Offset + Size, Segment.begin());
+
+      Append(File, static_cast<uint32_t>(SEGMENT_SIZE));
+      File.insert(File.end(), Segment.begin(), Segment.end());
+    }
+    else
+    {
+      Append(File, static_cast<uint32_t>(CompressedSize));
+      File.insert(File.end(), Buffer.begin(), Buffer.begin() + CompressedSize);
+    }
+  }
+}
+
+bool BundleStress::Verify(
+    const Bundle &      _Bundle,
+    const std::string & _WorkFolder
+  )
+{
+  // Alone in its folder, the folder unpackers take every file there as a bundle
+  const std::string FileName = _WorkFolder + "/bundles/bundle";
+
+  {
+    std::ofstream File(FileName, std::ios::binary | std::ios::trunc);
+    File.write(reinterpret_cast<const char *>(_Bundle.File.data()), _Bundle.File.size());
+  }
+
+  const uint64_t Failures = m_Failures;
+
+  const auto Check = [&](bool _Condition, const char * _What)
+  {
+    if (!_Condition)
+    {
+      std::cerr << "Mismatch: " << _What << std::endl;
+      m_Failures++;
+    }
+  };
+
+  // Reference segment reader, everything else is compared with what it inflates
+  ReferenceUnpacker          Reference;
+  std::vector<unsigned char> Package;
+
+  AddTiming("reference read", Measure([&] { Package = Reference.ReadSegmentCompressedFile(FileName); }), _Bundle.File.size());
+
+  // Generated package, plus the zero padding of a stored last segment
+  const auto IsPackage = [&](const std::vector<unsigned char> & _Package)
+  {
+    return _Package.size() >= _Bundle.Package.size() && std::equal(_Bundle.Package.begin(), _Bundle.Package.end(), _Package.begin()) &&
+           std::all_of(_Package.begin() + _Bundle.Package.size(), _Package.end(), [](unsigned char _Byte) { return _Byte == 0; });
+  };
+
+  if (_Bundle.Valid)
+    Check(IsPackage(Package), "reference package");
+
+  FastUnpacker Fast;
+  bool         SamePackage = false;
+
+  AddTiming("buffered read", Measure([&]
+    {
+      const auto & Buffered = Fast.ReadSegmentCompressedFile(FileName);
+      SamePackage = std::equal(Buffered.begin(), Buffered.end(), Package.begin(), Package.end());
+    }), _Bundle.File.size());
+  Check(SamePackage, "buffered package");
+
+  // Random access index, straight from the bundle and through a header cache
+  SegmentCache                              Cache;
+  std::vector<std::unique_ptr<BundleIndex>> Indices;
+  bool                                      Opened = false;
+
+  Indices.push_back(std::make_unique<BundleIndex>());
+  AddTiming("index open", Measure([&] { Opened = Indices[0]->Open(FileName, &Cache); }), _Bundle.File.size());
+
+  Check(Opened || !_Bundle.Valid, "index open");
+
+  std::vector<BundleIndex::Resource> Resources;
+
+  if (Opened)
+  {
+    const BundleIndex & Index = *Indices[0];
+    Resources = Index.GetResources();
+
+    std::vector<unsigned char> Inflated(Index.GetUncompressedSize());
+    bool                       Read = false;
+
+    AddTiming("index read", Measure([&] { Read = Index.Read(0, Inflated.data(), Inflated.size()); }), Inflated.size());
+    // The index inflates lazily, a broken segment only shows when read
+    Check(Read ? Inflated == Package : Package.size() < Inflated.size(), "index package");
+
+    if (_Bundle.Valid)
+    {
+      Check(SameResources(Resources, _Bundle.Resources), "index resources");
+    }
+
+    HeaderCache Headers;
+    BundleIndex Cached;
+
+    Check(HeaderCache::Write(_WorkFolder + "/headers", Indices) && Headers.Open(_WorkFolder + "/headers"), "header cache write");
+    AddTiming("header cache open", Measure([&] { Opened = Cached.Open(FileName, &Cache, &Headers); }), _Bundle.File.size());
+    Check(Opened && SameResources(Cached.GetResources(), Resources), "header cache resources");
+  }
+
+  // Incremental parser of the pipelined unpack, fed in random sized pieces
+  std::vector<BundleIndex::Resource> Parsed;
+  bool                               PayloadsMatch = true;
+  uint64_t                           Position      = 0;
+
+  PackageParser Parser(
+    [&](const PackageParser::Record & _Record, uint64_t _Size)
+    {
+      Parsed.push_back(BundleIndex::Resource{ _Record.TypeHash, _Record.NameHash, UINT64_MAX, _Size });
+    },
+    [&](const unsigned char * _Data, uint64_t _Size)
+    {
+      if (Parsed.back().Offset == UINT64_MAX)
+        Parsed.back().Offset = _Data - Package.data();
+
+      PayloadsMatch = PayloadsMatch && _Data >= Package.data() && _Data + _Size <= Package.data() + Package.size();
+    });
+
+  AddTiming("parser", Measure([&]
+  {
+    while (Position < Package.size())
+    {
+      const uint64_t Size = std::min<uint64_t>(1 + m_Random() % SEGMENT_SIZE, Package.size() - Position);
+
+      if (!Parser.Feed(Package.data() + Position, Size))
+        break;
+
+      Position += Size;
+    }
+  }), Package.size());
+
+  Check(PayloadsMatch, "parser payload bounds");
+
+  // Empty resources never see a payload callback, their offset is unknown here
+  for (size_t i = 0; i < Parsed.size() && i < Resources.size(); ++i)
+  {
+    if (Parsed[i].Size == 0)
+      Parsed[i].Offset = Resources[i].Offset;
+  }
+
+  if (Opened && Parser.IsComplete())
+    Check(SameResources(Parsed, Resources), "parser resources");
+
+  // Both unpackers on the same package, they have to agree with each other and the parser
+  int32_t ReferenceCount = 0;
+  int32_t FastCount      = 0;
+
+  const FastUnpacker::PackageBuffer FastPackage(Package.begin(), Package.end());
+
+  AddTiming("reference unpack", Measure([&] { ReferenceCount = Reference.UnpackBitsquidPackage(Package, _WorkFolder + "/reference"); }), Package.size());
+  AddTiming("unpack", Measure([&] { FastCount = Fast.UnpackBitsquidPackage(FastPackage, _WorkFolder + "/unpack"); }), Package.size());
+
+  Check(ReferenceCount == FastCount, "unpack result");
+  Check((FastCount >= 0) == Parser.IsComplete(), "unpack and parser result");
+
+  // Written files of the resources _Expected selects, and no file for the others
+  const auto CheckFolder = [&](const std::string & _Folder, const char * _What, auto _Expected)
+  {
+    std::string                OutputFileName;
+    std::vector<unsigned char> Written;
+
+    for (const auto & Resource : _Bundle.Resources)
+    {
+      Fast.BuildOutputFileName(OutputFileName, _Folder, Resource.TypeHash, Resource.NameHash);
+
+      if (!_Expected(Resource))
+      {
+        if (std::filesystem::exists(OutputFileName))
+        {
+          Check(false, _What);
+          break;
+        }
+
+        continue;
+      }
+
+      std::ifstream File(OutputFileName, std::ios::binary);
+      Written.assign(std::istreambuf_iterator<char>(File), std::istreambuf_iterator<char>());
+
+      if (!File.is_open() || Written.size() != Resource.Size || !std::equal(Written.begin(), Written.end(), _Bundle.Package.begin() + Resource.Offset))
+      {
+        Check(false, _What);
+        break;
+      }
+    }
+  };
+
+  const auto Everything = [](const Resource &) { return true; };
+
+  if (_Bundle.Valid)
+  {
+    Check(FastCount == static_cast<int32_t>(_Bundle.Resources.size()), "unpack count");
+    CheckFolder(_WorkFolder + "/unpack", "unpacked file", Everything);
+  }
+
+  // Folder unpackers on the same bundle, the pipelined one with a budget
+  // small enough to stream resources, the filtered one on a single type
+  const std::string PipelinedFolder = _WorkFolder + "/pipelined";
+  const std::string FilteredFolder  = _WorkFolder + "/filtered";
+
+  std::error_code Error;
+  std::filesystem::remove_all(PipelinedFolder, Error);
+  std::filesystem::remove_all(FilteredFolder, Error);
+
+  SegmentedFileDecompressor Pipelined;
+  SegmentedFileDecompressor Filtered;
+  ResourceFilter            Filter;
+
+  const uint64_t FilteredType = _Bundle.Resources.empty() ? 0 : _Bundle.Resources[m_Random() % _Bundle.Resources.size()].TypeHash;
+
+  Pipelined.SetMemoryLimit(1024 * 1024);
+  Filter.IncludeType(std::to_string(FilteredType));
+  Filtered.SetFilter(Filter);
+
+  AddTiming("pipelined unpack", Measure([&] { Quietly([&] { Pipelined.Decompress(_WorkFolder + "/bundles", PipelinedFolder); }); }), Package.size());
+  AddTiming("filtered unpack", Measure([&] { Quietly([&] { Filtered.Decompress(_WorkFolder + "/bundles", FilteredFolder); }); }), Package.size());
+
+  if (_Bundle.Valid)
+  {
+    CheckFolder(PipelinedFolder, "pipelined file", Everything);
+    CheckFolder(FilteredFolder, "filtered file", [&](const Resource & _Resource) { return _Resource.TypeHash == FilteredType; });
+  }
+
+  // Patch from an older version of the bundle with one payload changed,
+  // and a tampered copy of the patch that must never produce another package
+  if (_Bundle.Valid)
+  {
+    Bundle Older;
+    Older.Package = _Bundle.Package;
+
+    if (!_Bundle.Resources.empty())
+    {
+      const Resource & Changed = _Bundle.Resources[m_Random() % _Bundle.Resources.size()];
+
+      for (uint64_t i = 0; i < Changed.Size; ++i)
+        Older.Package[Changed.Offset + i] ^= 0x5A;
+    }
+
+    CompressSegments(Older);
+
+    const std::string OlderName   = _WorkFolder + "/older";
+    const std::string PatchName   = _WorkFolder + "/bundle.patch";
+    const std::string PatchedName = _WorkFolder + "/patched";
+
+    {
+      std::ofstream File(OlderName, std::ios::binary | std::ios::trunc);
+      File.write(reinterpret_cast<const char *>(Older.File.data()), Older.File.size());
+    }
+
+    BundlePatch Patch;
+    bool        Applied = false;
+
+    Quietly([&] { Applied = Patch.Create(OlderName, FileName, PatchName); });
+    AddTiming("patch apply", Measure([&] { Quietly([&] { Applied = Applied && Patch.Apply(OlderName, PatchName, PatchedName); }); }), Package.size());
+
+    Check(Applied && IsPackage(Reference.ReadSegmentCompressedFile(PatchedName)), "patched package");
+
+    std::vector<unsigned char> Tampered;
+
+    {
+      std::ifstream File(PatchName, std::ios::binary);
+      Tampered.assign(std::istreambuf_iterator<char>(File), std::istreambuf_iterator<char>());
+    }
+
+    if (!Tampered.empty())
+    {
+      Tampered[m_Random() % Tampered.size()] ^= static_cast<unsigned char>(1 + m_Random() % 255);
+
+      std::ofstream(PatchName, std::ios::binary | std::ios::trunc).write(reinterpret_cast<const char *>(Tampered.data()), Tampered.size());
+      std::filesystem::remove(PatchedName, Error);
+
+      Quietly([&] { Applied = Patch.Apply(OlderName, PatchName, PatchedName); });
+
+      Check(!Applied || IsPackage(Reference.ReadSegmentCompressedFile(PatchedName)), "tampered patch");
+    }
+  }
+
+  return m_Failures == Failures;
+}
+
+void BundleStress::AddTiming(
+    const std::string & _Name,
+    double              _Seconds,
+    uint64_t            _Bytes
+  )
+{
+  const auto it = std::find_if(m_Timings.begin(), m_Timings.end(), [&](const Timing & _Timing) { return _Timing.Name == _Name; });
+
+  if (it == m_Timings.end())
+  {
+    m_Timings.push_back(Timing{ _Name, _Seconds, _Bytes });
+    return;
+  }
+
+  it->Seconds += _Seconds;
+  it->Bytes   += _Bytes;
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdint>
+
+// Synthetic bundles with pathological shapes, unpacked by every parser in
+// the tree and checked against what was generated and against the
+// reference SegmentedFile implementation. Reports the throughput of each
+// parser, and its truncated / mutated shapes make it a crash harness too.
+class BundleStress
+{
+public: // Types
+
+  enum class Shape
+  {
+    ManyRecords,  // Huge record table of tiny resources
+    FullSegments, // Incompressible 64 KiB chunks, every segment stored
+    ManyChunks,   // Resources split into chunks around the segment size
+    StreamSizes,  // Chunks with a nonzero stream size, as third party packers write
+    Truncated,    // Valid bundles cut at a random point
+    Mutated       // Random byte flips plus forged counts and sizes
+  };
+
+  struct Options
+  {
+    uint64_t Seed       = 1;
+    uint32_t Iterations = 4;
+    uint32_t Records    = 50000;
+  };
+
+public: // Interface
+
+  // _Shape is a shape name or "all", bundles and unpacked files go to _WorkFolder
+  bool Run(
+      const std::string & _Shape,
+      const std::string & _WorkFolder,
+      const Options &     _Options
+    );
+
+protected: // Types
+
+  struct Resource
+  {
+    uint64_t TypeHash;
+    uint64_t NameHash;
+    uint64_t Offset; // Payload position in the package
+    uint64_t Size;
+  };
+
+  struct Bundle
+  {
+    std::vector<Resource>              Resources;
+    std::vector<std::vector<uint64_t>> Chunks;
+    std::vector<unsigned char>         Payloads;           // All payloads back to back
+    std::vector<unsigned char>         Package;
+    std::vector<uint64_t>              ChunkCountOffsets;  // In the package, for forging
+    std::vector<unsigned char>         File;
+    std::vector<uint64_t>              SegmentSizeOffsets; // In the file, for forging
+    uint32_t                           StreamSize = 0;     // Of every chunk, never part of the payload
+    bool                               Valid = true;
+  };
+
+  struct Timing
+  {
+    std::string Name;
+    double      Seconds = 0;
+    uint64_t    Bytes   = 0;
+  };
+
+protected: // Service
+
+  void Generate(
+      Shape    _Shape,
+      Bundle & _Bundle
+    );
+
+  void AddResource(
+      Bundle &                      _Bundle,
+      uint64_t                      _TypeHash,
+      uint64_t                      _NameHash,
+      const std::vector<uint64_t> & _Chunks,
+      bool                          _Compressible
+    );
+
+  static void BuildPackage(
+      Bundle & _Bundle
+    );
+
+  void Corrupt(
+      Shape    _Shape,
+      Bundle & _Bundle
+    );
+
+  static void CompressSegments(
+      Bundle & _Bundle
+    );
+
+  bool Verify(
+      const Bundle &      _Bundle,
+      const std::string & _WorkFolder
+    );
+
+  void AddTiming(
+      const std::string & _Name,
+      double              _Seconds,
+      uint64_t            _Bytes
+    );
+
+protected: // Members
+
+  Options             m_Options;
+  std::mt19937_64     m_Random;
+  std::vector<Timing> m_Timings;
+  uint64_t            m_Failures = 0;
+};
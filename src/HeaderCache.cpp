@@ -0,0 +1,416 @@
+#include "HeaderCache.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+
+namespace
+{
+  constexpr uint32_t HEADER_CACHE_MAGIC   = 0x4348554D; // "MUHC"
+  constexpr uint32_t HEADER_CACHE_VERSION = 1;
+
+  struct FileHeader
+  {
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t EntryCount;
+  };
+
+  struct SegmentEntry
+  {
+    uint64_t Offset;
+    uint64_t CompressedSize;
+  };
+
+  struct ResourceEntry
+  {
+    uint64_t TypeHash;
+    uint64_t NameHash;
+    uint64_t Offset;
+    uint64_t Size;
+  };
+
+  // Count elements of _ElementSize at _Offset fit in a file of _FileSize bytes
+  bool IsInFile(uint64_t _Offset, uint64_t _Count, uint64_t _ElementSize, uint64_t _FileSize)
+  {
+    return _Offset <= _FileSize && _Count <= (_FileSize - _Offset) / _ElementSize;
+  }
+}
+
+//
+// Interface
+//
+
+bool HeaderCache::Open(
+    const std::string & _FileName
+  )
+{
+  Close();
+
+  if (!m_File.Open(_FileName))
+    return false;
+
+  FileHeader Header{};
+
+  if (m_File.GetSize() < sizeof(Header))
+  {
+    Close();
+    return false;
+  }
+
+  std::memcpy(&Header, m_File.GetData(), sizeof(Header));
+
+  if (Header.Magic != HEADER_CACHE_MAGIC || Header.Version != HEADER_CACHE_VERSION ||
+      !IsInFile(sizeof(Header), Header.EntryCount, sizeof(Entry), m_File.GetSize()))
+  {
+    Close();
+    return false;
+  }
+
+  m_EntryCount = Header.EntryCount;
+
+  return true;
+}
+
+void HeaderCache::Close()
+{
+  m_File.Close();
+  m_EntryCount = 0;
+}
+
+int64_t HeaderCache::Find(
+    const std::string & _BundleFile
+  ) const
+{
+  const std::string Name = std::filesystem::path(_BundleFile).filename().string();
+
+  // Entries are sorted by name when written
+  uint64_t First = 0;
+  uint64_t Last  = m_EntryCount;
+
+  while (First < Last)
+  {
+    const uint64_t Middle = First + (Last - First) / 2;
+
+    if (GetName(ReadEntry(Middle)) < Name)
+      First = Middle + 1;
+    else
+      Last = Middle;
+  }
+
+  if (First == m_EntryCount)
+    return NOT_FOUND;
+
+  const Entry Found = ReadEntry(First);
+
+  if (GetName(Found) != Name ||
+      !IsInFile(Found.SegmentsOffset, Found.SegmentCount, sizeof(SegmentEntry), m_File.GetSize()) ||
+      !IsInFile(Found.ResourcesOffset, Found.ResourceCount, sizeof(ResourceEntry), m_File.GetSize()))
+  {
+    return NOT_FOUND;
+  }
+
+  uint64_t FileSize     = 0;
+  int64_t  ModifiedTime = 0;
+
+  if (!GetFileStamp(_BundleFile, FileSize, ModifiedTime) || FileSize != Found.FileSize || ModifiedTime != Found.ModifiedTime)
+    return NOT_FOUND;
+
+  return static_cast<int64_t>(First);
+}
+
+uint64_t HeaderCache::GetUncompressedSize(
+    uint64_t _Entry
+  ) const
+{
+  return ReadEntry(_Entry).UncompressedSize;
+}
+
+uint64_t HeaderCache::GetSegmentCount(
+    uint64_t _Entry
+  ) const
+{
+  return ReadEntry(_Entry).SegmentCount;
+}
+
+bool HeaderCache::GetSegment(
+    uint64_t               _Entry,
+    uint64_t               _Index,
+    BundleIndex::Segment & _Segment
+  ) const
+{
+  SegmentEntry Segment{};
+  std::memcpy(&Segment, m_File.GetData() + ReadEntry(_Entry).SegmentsOffset + _Index * sizeof(Segment), sizeof(Segment));
+
+  // Checked before narrowing, a stale cache must not wrap into a valid size
+  if (Segment.CompressedSize > BundleIndex::SEGMENT_SIZE)
+    return false;
+
+  _Segment = BundleIndex::Segment{ Segment.Offset, static_cast<uint32_t>(Segment.CompressedSize) };
+
+  return true;
+}
+
+uint64_t HeaderCache::GetResourceCount(
+    uint64_t _Entry
+  ) const
+{
+  return ReadEntry(_Entry).ResourceCount;
+}
+
+BundleIndex::Resource HeaderCache::GetResource(
+    uint64_t _Entry,
+    uint64_t _Index
+  ) const
+{
+  ResourceEntry Resource{};
+  std::memcpy(&Resource, m_File.GetData() + ReadEntry(_Entry).ResourcesOffset + _Index * sizeof(Resource), sizeof(Resource));
+
+  return BundleIndex::Resource{ Resource.TypeHash, Resource.NameHash, Resource.Offset, Resource.Size };
+}
+
+bool HeaderCache::OpenFolder(
+    const std::string &                         _Folder,
+    const std::string &                         _CacheFile,
+    SegmentCache *                              _Cache,
+    std::vector<std::unique_ptr<BundleIndex>> & _Bundles
+  )
+{
+  return LoadFolder(_Folder, _CacheFile, _Cache, _Bundles, nullptr, false);
+}
+
+bool HeaderCache::IndexFolder(
+    const std::string &                         _Folder,
+    const std::string &                         _CacheFile,
+    SegmentCache *                              _Cache,
+    std::vector<std::unique_ptr<BundleIndex>> & _Bundles
+  )
+{
+  return LoadFolder(_Folder, _CacheFile, _Cache, _Bundles, nullptr, true);
+}
+
+bool HeaderCache::VisitFolder(
+    const std::string & _Folder,
+    const std::string & _CacheFile,
+    SegmentCache *      _Cache,
+    const Visitor &     _Visit
+  )
+{
+  // Closed bundles keep their tables, enough to rewrite the cache afterwards
+  std::vector<std::unique_ptr<BundleIndex>> Bundles;
+
+  return LoadFolder(_Folder, _CacheFile, _Cache, Bundles, &_Visit, true);
+}
+
+bool HeaderCache::Write(
+    const std::string &                               _FileName,
+    const std::vector<std::unique_ptr<BundleIndex>> & _Bundles
+  )
+{
+  std::vector<std::string> Names(_Bundles.size());
+  std::vector<Entry>       Entries(_Bundles.size());
+
+  for (size_t i = 0; i < _Bundles.size(); ++i)
+  {
+    Names[i] = std::filesystem::path(_Bundles[i]->GetFileName()).filename().string();
+
+    if (!GetFileStamp(_Bundles[i]->GetFileName(), Entries[i].FileSize, Entries[i].ModifiedTime))
+      return false;
+  }
+
+  std::vector<size_t> Order(_Bundles.size());
+  std::iota(Order.begin(), Order.end(), 0);
+  std::sort(Order.begin(), Order.end(), [&](size_t lhs, size_t rhs) { return Names[lhs] < Names[rhs]; });
+
+  // Names, then segment tables, then record tables, every block 8 byte aligned
+  uint64_t Offset = sizeof(FileHeader) + Entries.size() * sizeof(Entry);
+
+  for (const size_t i : Order)
+  {
+    Entries[i].NameOffset = Offset;
+    Entries[i].NameLength = Names[i].size();
+    Offset += (Names[i].size() + 7) & ~uint64_t(7);
+  }
+
+  for (const size_t i : Order)
+  {
+    Entries[i].UncompressedSize = _Bundles[i]->GetUncompressedSize();
+    Entries[i].SegmentsOffset   = Offset;
+    Entries[i].SegmentCount     = _Bundles[i]->GetSegments().size();
+    Offset += Entries[i].SegmentCount * sizeof(SegmentEntry);
+  }
+
+  for (const size_t i : Order)
+  {
+    Entries[i].ResourcesOffset = Offset;
+    Entries[i].ResourceCount   = _Bundles[i]->GetResources().size();
+    Offset += Entries[i].ResourceCount * sizeof(ResourceEntry);
+  }
+
+  // Written aside and renamed over, readers never map a half written cache
+  const std::string TemporaryName = _FileName + ".tmp";
+
+  {
+    std::ofstream File(TemporaryName, std::ios::binary | std::ios::trunc);
+
+    const FileHeader Header{ HEADER_CACHE_MAGIC, HEADER_CACHE_VERSION, Entries.size() };
+    File.write(reinterpret_cast<const char *>(&Header), sizeof(Header));
+
+    for (const size_t i : Order)
+      File.write(reinterpret_cast<const char *>(&Entries[i]), sizeof(Entry));
+
+    const char Padding[8] = {};
+
+    for (const size_t i : Order)
+    {
+      File.write(Names[i].data(), Names[i].size());
+      File.write(Padding, ((Names[i].size() + 7) & ~size_t(7)) - Names[i].size());
+    }
+
+    for (const size_t i : Order)
+    {
+      for (const auto & Segment : _Bundles[i]->GetSegments())
+      {
+        const SegmentEntry Item{ Segment.Offset, Segment.CompressedSize };
+        File.write(reinterpret_cast<const char *>(&Item), sizeof(Item));
+      }
+    }
+
+    for (const size_t i : Order)
+    {
+      for (const auto & Resource : _Bundles[i]->GetResources())
+      {
+        const ResourceEntry Item{ Resource.TypeHash, Resource.NameHash, Resource.Offset, Resource.Size };
+        File.write(reinterpret_cast<const char *>(&Item), sizeof(Item));
+      }
+    }
+
+    if (!File)
+      return false;
+  }
+
+  std::error_code Error;
+  std::filesystem::rename(TemporaryName, _FileName, Error);
+
+  return !Error;
+}
+
+//
+// Service
+//
+
+bool HeaderCache::LoadFolder(
+    const std::string &                         _Folder,
+    const std::string &                         _CacheFile,
+    SegmentCache *                              _Cache,
+    std::vector<std::unique_ptr<BundleIndex>> & _Bundles,
+    const Visitor *                             _Visit,
+    bool                                        _Close
+  )
+{
+  if (!std::filesystem::exists(_Folder) ||
+      !std::filesystem::is_directory(_Folder))
+  {
+    return false;
+  }
+
+  if (!_CacheFile.empty())
+    Open(_CacheFile);
+
+  std::vector<std::string> Files;
+
+  for (const auto & File : std::filesystem::directory_iterator(_Folder))
+  {
+    std::error_code Error;
+
+    if (File.is_directory() || (!_CacheFile.empty() && std::filesystem::equivalent(File.path(), _CacheFile, Error)))
+      continue;
+
+    Files.push_back(File.path().string());
+  }
+
+  std::sort(Files.begin(), Files.end());
+
+  uint64_t CachedCount = 0;
+
+  for (size_t i = 0; i < Files.size(); ++i)
+  {
+    auto Bundle = std::make_unique<BundleIndex>();
+
+    if (!Bundle->Open(Files[i], _Cache, this))
+    {
+      std::cerr << "Skipping " << Files[i] << ": not a bundle\n";
+      continue;
+    }
+
+    if (Bundle->IsFromHeaderCache())
+      CachedCount++;
+
+    if (_Visit && !(*_Visit)(*Bundle, i, Files.size()))
+      return false;
+
+    if (_Close)
+      Bundle->Close();
+
+    // Visited bundles are only kept to rewrite the cache
+    if (_Visit && _CacheFile.empty())
+      continue;
+
+    _Bundles.push_back(std::move(Bundle));
+  }
+
+  if (_CacheFile.empty() || (CachedCount == _Bundles.size() && CachedCount == m_EntryCount))
+    return true;
+
+  // Pull the remaining records out of the old cache before it is replaced
+  for (const auto & Bundle : _Bundles)
+    Bundle->GetResources();
+
+  Close();
+
+  if (!Write(_CacheFile, _Bundles))
+    std::cerr << "Cannot write header cache " << _CacheFile << std::endl;
+
+  return true;
+}
+
+HeaderCache::Entry HeaderCache::ReadEntry(
+    uint64_t _Entry
+  ) const
+{
+  Entry Item{};
+  std::memcpy(&Item, m_File.GetData() + sizeof(FileHeader) + _Entry * sizeof(Entry), sizeof(Item));
+
+  return Item;
+}
+
+std::string_view HeaderCache::GetName(
+    const Entry & _Entry
+  ) const
+{
+  if (!IsInFile(_Entry.NameOffset, _Entry.NameLength, 1, m_File.GetSize()))
+    return {};
+
+  return std::string_view(reinterpret_cast<const char *>(m_File.GetData()) + _Entry.NameOffset, _Entry.NameLength);
+}
+
+bool HeaderCache::GetFileStamp(
+    const std::string & _FileName,
+    uint64_t &          _Size,
+    int64_t &           _ModifiedTime
+  )
+{
+  std::error_code Error;
+
+  _Size = std::filesystem::file_size(_FileName, Error);
+
+  if (Error)
+    return false;
+
+  _ModifiedTime = std::filesystem::last_write_time(_FileName, Error).time_since_epoch().count();
+
+  return !Error;
+}
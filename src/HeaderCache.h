@@ -0,0 +1,142 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+#include "BundleIndex.h"
+#include "MappedFile.h"
+#include "SegmentCache.h"
+
+// Persisted segment and record tables of a bundles folder, so opening a
+// bundle neither walks its segments nor inflates its record table.
+// Entries are keyed by bundle file name and only trusted while the bundle
+// size and modification time still match. Nothing is parsed up front, an
+// entry is read from the mapped cache when a bundle asks for it.
+class HeaderCache
+{
+public: // Constants
+
+  static constexpr int64_t NOT_FOUND = -1;
+
+public: // Interface
+
+  bool Open(
+      const std::string & _FileName
+    );
+
+  void Close();
+
+  // Entry of the bundle when it still describes the file on disk
+  int64_t Find(
+      const std::string & _BundleFile
+    ) const;
+
+  uint64_t GetUncompressedSize(
+      uint64_t _Entry
+    ) const;
+
+  uint64_t GetSegmentCount(
+      uint64_t _Entry
+    ) const;
+
+  // False when the cached entry cannot describe a segment
+  bool GetSegment(
+      uint64_t               _Entry,
+      uint64_t               _Index,
+      BundleIndex::Segment & _Segment
+    ) const;
+
+  uint64_t GetResourceCount(
+      uint64_t _Entry
+    ) const;
+
+  BundleIndex::Resource GetResource(
+      uint64_t _Entry,
+      uint64_t _Index
+    ) const;
+
+  // Opens every bundle of the folder, from the cache where it is still
+  // valid, and rewrites _CacheFile when any bundle had to be scanned.
+  // The cache has to outlive the bundles, their records are read lazily.
+  bool OpenFolder(
+      const std::string &                         _Folder,
+      const std::string &                         _CacheFile,
+      SegmentCache *                              _Cache,
+      std::vector<std::unique_ptr<BundleIndex>> & _Bundles
+    );
+
+  // Same as OpenFolder, but hands the bundles to _Visit one at a time and
+  // closes each file before the next is opened, so any number of bundles
+  // fits the descriptor limit. Stops early when _Visit returns false.
+  using Visitor = std::function<bool(BundleIndex & _Bundle, uint64_t _Index, uint64_t _Count)>;
+
+  // Same as OpenFolder, but each bundle is closed again once its tables are
+  // read, long running front ends reopen them on demand (OpenBundleCache)
+  bool IndexFolder(
+      const std::string &                         _Folder,
+      const std::string &                         _CacheFile,
+      SegmentCache *                              _Cache,
+      std::vector<std::unique_ptr<BundleIndex>> & _Bundles
+    );
+
+  bool VisitFolder(
+      const std::string & _Folder,
+      const std::string & _CacheFile,
+      SegmentCache *      _Cache,
+      const Visitor &     _Visit
+    );
+
+  static bool Write(
+      const std::string &                               _FileName,
+      const std::vector<std::unique_ptr<BundleIndex>> & _Bundles
+    );
+
+protected: // Types
+
+  struct Entry
+  {
+    uint64_t NameOffset;
+    uint64_t NameLength;
+    uint64_t FileSize;
+    int64_t  ModifiedTime;
+    uint64_t UncompressedSize;
+    uint64_t SegmentsOffset;
+    uint64_t SegmentCount;
+    uint64_t ResourcesOffset;
+    uint64_t ResourceCount;
+  };
+
+protected: // Service
+
+  // Hands every bundle to _Visit when set, then closes it with _Close
+  bool LoadFolder(
+      const std::string &                         _Folder,
+      const std::string &                         _CacheFile,
+      SegmentCache *                              _Cache,
+      std::vector<std::unique_ptr<BundleIndex>> & _Bundles,
+      const Visitor *                             _Visit,
+      bool                                        _Close
+    );
+
+  Entry ReadEntry(
+      uint64_t _Entry
+    ) const;
+
+  std::string_view GetName(
+      const Entry & _Entry
+    ) const;
+
+  static bool GetFileStamp(
+      const std::string & _FileName,
+      uint64_t &          _Size,
+      int64_t &           _ModifiedTime
+    );
+
+protected: // Members
+
+  MappedFile m_File;
+  uint64_t   m_EntryCount = 0;
+};
@@ -0,0 +1,180 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//
+// Construction
+//
+
+MappedFile::~MappedFile()
+{
+  Close();
+}
+
+//
+// Interface
+//
+
+bool MappedFile::Open(
+    const std::string & _FileName
+  )
+{
+  Close();
+
+#ifdef _WIN32
+
+  m_File = CreateFileA(_FileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+  if (m_File == INVALID_HANDLE_VALUE)
+  {
+    m_File = nullptr;
+    return false;
+  }
+
+  LARGE_INTEGER Size;
+
+  if (!GetFileSizeEx(m_File, &Size))
+  {
+    Close();
+    return false;
+  }
+
+  m_Size = Size.QuadPart;
+
+  if (m_Size == 0)
+    return true;
+
+  m_Mapping = CreateFileMappingA(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+  if (!m_Mapping)
+  {
+    Close();
+    return false;
+  }
+
+  m_Data = static_cast<const unsigned char *>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+
+#else
+
+  m_Descriptor = open(_FileName.c_str(), O_RDONLY);
+
+  if (m_Descriptor < 0)
+    return false;
+
+  struct stat Stat;
+
+  if (fstat(m_Descriptor, &Stat) != 0)
+  {
+    Close();
+    return false;
+  }
+
+  m_Size = Stat.st_size;
+
+  if (m_Size == 0)
+    return true;
+
+  void * Data = mmap(nullptr, m_Size, PROT_READ, MAP_SHARED, m_Descriptor, 0);
+
+  m_Data = Data == MAP_FAILED ? nullptr : static_cast<const unsigned char *>(Data);
+
+#endif
+
+  if (!m_Data)
+  {
+    Close();
+    return false;
+  }
+
+  return true;
+}
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+
+  if (m_Data)
+    UnmapViewOfFile(m_Data);
+
+  if (m_Mapping)
+    CloseHandle(m_Mapping);
+
+  if (m_File)
+    CloseHandle(m_File);
+
+  m_Mapping = nullptr;
+  m_File    = nullptr;
+
+#else
+
+  if (m_Data)
+    munmap(const_cast<unsigned char *>(m_Data), m_Size);
+
+  if (m_Descriptor >= 0)
+    close(m_Descriptor);
+
+#endif
+
+  m_Data       = nullptr;
+  m_Size       = 0;
+  m_Descriptor = -1;
+}
+
+const unsigned char * MappedFile::GetData() const
+{
+  return m_Data;
+}
+
+uint64_t MappedFile::GetSize() const
+{
+  return m_Size;
+}
+
+void MappedFile::WillNeed(
+    uint64_t _Offset,
+    uint64_t _Size
+  ) const
+{
+  if (!m_Data || _Offset >= m_Size)
+    return;
+
+  if (_Size > m_Size - _Offset)
+    _Size = m_Size - _Offset;
+
+  // Windows relies on FILE_FLAG_SEQUENTIAL_SCAN and on callers touching the pages
+#ifndef _WIN32
+
+  // madvise wants a page aligned start
+  const uint64_t PageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+  const uint64_t Begin    = _Offset / PageSize * PageSize;
+
+  madvise(const_cast<unsigned char *>(m_Data) + Begin, _Offset + _Size - Begin, MADV_WILLNEED);
+  posix_fadvise(m_Descriptor, Begin, _Offset + _Size - Begin, POSIX_FADV_WILLNEED);
+
+#endif
+}
+
+void MappedFile::AdviseSequential() const
+{
+  if (!m_Data)
+    return;
+
+#ifndef _WIN32
+
+  madvise(const_cast<unsigned char *>(m_Data), m_Size, MADV_SEQUENTIAL);
+  posix_fadvise(m_Descriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+#endif
+}
+
+int MappedFile::GetDescriptor() const
+{
+  return m_Descriptor;
+}
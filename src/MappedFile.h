@@ -0,0 +1,50 @@
+#pragma once
+#include <string>
+#include <cstdint>
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public: // Construction
+
+  MappedFile() = default;
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile & operator=(const MappedFile &) = delete;
+
+public: // Interface
+
+  bool Open(
+      const std::string & _FileName
+    );
+
+  void Close();
+
+  const unsigned char * GetData() const;
+
+  uint64_t GetSize() const;
+
+  // Native descriptor, lets callers hand byte ranges to the kernel directly
+  int GetDescriptor() const;
+
+  // Hints that the range is needed soon so the kernel starts reading it
+  void WillNeed(
+      uint64_t _Offset,
+      uint64_t _Size
+    ) const;
+
+  // Hints front to back access, widening the kernel readahead window
+  void AdviseSequential() const;
+
+protected: // Members
+
+  const unsigned char * m_Data = nullptr;
+  uint64_t              m_Size = 0;
+  int                   m_Descriptor = -1;
+
+#ifdef _WIN32
+  void *                m_File    = nullptr;
+  void *                m_Mapping = nullptr;
+#endif
+};
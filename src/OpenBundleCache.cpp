@@ -0,0 +1,89 @@
+#include "OpenBundleCache.h"
+
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+  constexpr size_t MAX_OPEN_BUNDLES = 256;
+
+  size_t GetDefaultCapacity()
+  {
+#ifndef _WIN32
+    rlimit Limit{};
+
+    if (getrlimit(RLIMIT_NOFILE, &Limit) == 0 && Limit.rlim_cur != RLIM_INFINITY)
+      return std::clamp<size_t>(Limit.rlim_cur / 2, 1, MAX_OPEN_BUNDLES);
+#endif
+
+    return MAX_OPEN_BUNDLES;
+  }
+}
+
+//
+// Construction
+//
+
+OpenBundleCache::OpenBundleCache(
+    size_t _Capacity
+  )
+  : m_Capacity(_Capacity != 0 ? _Capacity : GetDefaultCapacity())
+{
+}
+
+//
+// Interface
+//
+
+bool OpenBundleCache::Acquire(
+    BundleIndex & _Bundle
+  )
+{
+  std::lock_guard Lock(m_Mutex);
+
+  const auto it = m_Open.find(&_Bundle);
+
+  if (it != m_Open.end())
+  {
+    m_Order.splice(m_Order.begin(), m_Order, it->second.Position);
+    it->second.Holders++;
+
+    return true;
+  }
+
+  if (!_Bundle.Reopen())
+    return false;
+
+  m_Order.push_front(&_Bundle);
+  m_Open.emplace(&_Bundle, Entry{ 1, m_Order.begin() });
+
+  // Held bundles are skipped, with all of them held the limit is exceeded for a while
+  for (auto Candidate = m_Order.end(); m_Open.size() > m_Capacity && Candidate != m_Order.begin(); )
+  {
+    --Candidate;
+
+    if (m_Open.at(*Candidate).Holders != 0)
+      continue;
+
+    (*Candidate)->Close();
+    m_Open.erase(*Candidate);
+    Candidate = m_Order.erase(Candidate);
+  }
+
+  return true;
+}
+
+void OpenBundleCache::Release(
+    BundleIndex & _Bundle
+  )
+{
+  std::lock_guard Lock(m_Mutex);
+
+  const auto it = m_Open.find(&_Bundle);
+
+  if (it != m_Open.end() && it->second.Holders > 0)
+    it->second.Holders--;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <list>
+#include <map>
+#include <mutex>
+
+#include "BundleIndex.h"
+
+// Thread safe LRU of open bundles for front ends that index a whole folder
+// and keep the indices closed (HeaderCache::IndexFolder). A bundle is mapped
+// on first use and the least recently used one nobody holds is closed once
+// more than the limit are open, so any number of bundles fits the
+// descriptor limit.
+class OpenBundleCache
+{
+public: // Construction
+
+  // Zero picks a capacity that leaves half the descriptor limit to the caller
+  explicit OpenBundleCache(
+      size_t _Capacity = 0
+    );
+
+public: // Interface
+
+  // Opens the bundle when needed, it stays open until the matching Release
+  bool Acquire(
+      BundleIndex & _Bundle
+    );
+
+  void Release(
+      BundleIndex & _Bundle
+    );
+
+protected: // Members
+
+  struct Entry
+  {
+    uint32_t                           Holders;
+    std::list<BundleIndex *>::iterator Position;
+  };
+
+  std::mutex                     m_Mutex;
+  std::list<BundleIndex *>       m_Order; // Most recently used first
+  std::map<BundleIndex *, Entry> m_Open;
+  size_t                         m_Capacity;
+};
@@ -0,0 +1,213 @@
+#include "PackageParser.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+  constexpr uint64_t BITSQUID_PACKAGE_HEADER_SIZE = 256;
+
+  struct ResourceData
+  {
+    int32_t  _;
+    uint32_t FileSize;
+    uint32_t StreamSize;
+  };
+}
+
+//
+// Construction
+//
+
+PackageParser::PackageParser(
+    ResourceCallback _OnResource,
+    PayloadCallback  _OnPayload
+  )
+  : m_OnResource(std::move(_OnResource))
+  , m_OnPayload(std::move(_OnPayload))
+{
+  Reset();
+}
+
+//
+// Interface
+//
+
+void PackageParser::Reset()
+{
+  m_Records.clear();
+
+  m_RecordsCount = 0;
+  m_Resource     = 0;
+  m_ChunksLeft   = 0;
+  m_ResourceSize = 0;
+  m_PayloadLeft  = 0;
+
+  Expect(RecordsCount, sizeof(int32_t));
+}
+
+bool PackageParser::Feed(
+    const unsigned char * _Data,
+    uint64_t              _Size
+  )
+{
+  // Anything past the last resource is padding
+  while (_Size > 0 && m_State != Complete && m_State != Malformed)
+  {
+    if (m_State == Payload)
+    {
+      const uint64_t Count = std::min(_Size, m_PayloadLeft);
+
+      m_OnPayload(_Data, Count);
+
+      _Data         += Count;
+      _Size         -= Count;
+      m_PayloadLeft -= Count;
+
+      if (m_PayloadLeft == 0)
+        NextResource();
+
+      continue;
+    }
+
+    const uint64_t Count = std::min(_Size, m_Expected - m_Field.size());
+
+    m_Field.insert(m_Field.end(), _Data, _Data + Count);
+
+    _Data += Count;
+    _Size -= Count;
+
+    if (m_Field.size() == m_Expected && !ParseField())
+      m_State = Malformed;
+  }
+
+  return m_State != Malformed;
+}
+
+bool PackageParser::IsComplete() const
+{
+  return m_State == Complete;
+}
+
+//
+// Service
+//
+
+bool PackageParser::ParseField()
+{
+  switch (m_State)
+  {
+  case RecordsCount:
+  {
+    int32_t Count = 0;
+    std::memcpy(&Count, m_Field.data(), sizeof(Count));
+
+    if (Count < 0)
+      return false;
+
+    m_RecordsCount = Count;
+    Expect(PackageHeader, BITSQUID_PACKAGE_HEADER_SIZE);
+
+    return true;
+  }
+
+  case PackageHeader:
+    if (m_RecordsCount == 0)
+      m_State = Complete;
+    else
+      Expect(Records, sizeof(Record));
+
+    return true;
+
+  case Records:
+  {
+    Record Item{};
+    std::memcpy(&Item, m_Field.data(), sizeof(Item));
+
+    m_Records.push_back(Item);
+
+    if (m_Records.size() == m_RecordsCount)
+      Expect(ResourceInfo, sizeof(Record));
+    else
+      Expect(Records, sizeof(Record));
+
+    return true;
+  }
+
+  case ResourceInfo:
+    Expect(ChunkCount, sizeof(int64_t));
+    return true;
+
+  case ChunkCount:
+  {
+    int64_t Count = 0;
+    std::memcpy(&Count, m_Field.data(), sizeof(Count));
+
+    if (Count < 0)
+      return false;
+
+    m_ChunksLeft   = Count;
+    m_ResourceSize = 0;
+
+    if (m_ChunksLeft == 0)
+      BeginPayload();
+    else
+      Expect(Chunks, sizeof(ResourceData));
+
+    return true;
+  }
+
+  case Chunks:
+  {
+    ResourceData Chunk{};
+    std::memcpy(&Chunk, m_Field.data(), sizeof(Chunk));
+
+    const uint64_t ChunkSize = Chunk.FileSize;
+
+    if (ChunkSize > UINT64_MAX - m_ResourceSize)
+      return false;
+
+    m_ResourceSize += ChunkSize;
+
+    if (--m_ChunksLeft == 0)
+      BeginPayload();
+    else
+      Expect(Chunks, sizeof(ResourceData));
+
+    return true;
+  }
+
+  default:
+    return false;
+  }
+}
+
+void PackageParser::Expect(
+    int      _State,
+    uint64_t _Size
+  )
+{
+  m_State    = _State;
+  m_Expected = _Size;
+  m_Field.clear();
+}
+
+void PackageParser::BeginPayload()
+{
+  m_OnResource(m_Records[m_Resource], m_ResourceSize);
+
+  m_PayloadLeft = m_ResourceSize;
+
+  if (m_PayloadLeft == 0)
+    NextResource();
+  else
+    m_State = Payload;
+}
+
+void PackageParser::NextResource()
+{
+  if (++m_Resource == m_RecordsCount)
+    m_State = Complete;
+  else
+    Expect(ResourceInfo, sizeof(Record));
+}
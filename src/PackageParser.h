@@ -0,0 +1,85 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <functional>
+
+// Incremental parser for an inflated Bitsquid package. Bytes can be fed in
+// pieces of any size, e.g. one segment at a time, and resources are
+// reported as soon as their chunk table has been seen.
+class PackageParser
+{
+public: // Types
+
+  struct Record
+  {
+    uint64_t TypeHash;
+    uint64_t NameHash;
+  };
+
+  // Called once per resource before its payload, with the total chunk size
+  using ResourceCallback = std::function<void(const Record & _Record, uint64_t _Size)>;
+
+  // Called with consecutive pieces of the current resource payload
+  using PayloadCallback  = std::function<void(const unsigned char * _Data, uint64_t _Size)>;
+
+public: // Construction
+
+  PackageParser(
+      ResourceCallback _OnResource,
+      PayloadCallback  _OnPayload
+    );
+
+public: // Interface
+
+  void Reset();
+
+  // Returns false once the package turned out malformed
+  bool Feed(
+      const unsigned char * _Data,
+      uint64_t              _Size
+    );
+
+  bool IsComplete() const;
+
+protected: // Service
+
+  bool ParseField();
+
+  void Expect(
+      int      _State,
+      uint64_t _Size
+    );
+
+  void BeginPayload();
+
+  void NextResource();
+
+protected: // Members
+
+  enum State
+  {
+    RecordsCount,
+    PackageHeader,
+    Records,
+    ResourceInfo,
+    ChunkCount,
+    Chunks,
+    Payload,
+    Complete,
+    Malformed
+  };
+
+  ResourceCallback           m_OnResource;
+  PayloadCallback            m_OnPayload;
+
+  int                        m_State = RecordsCount;
+  uint64_t                   m_Expected = 0;
+  std::vector<unsigned char> m_Field;
+
+  std::vector<Record>        m_Records;
+  uint64_t                   m_RecordsCount = 0;
+  uint64_t                   m_Resource = 0;
+  uint64_t                   m_ChunksLeft = 0;
+  uint64_t                   m_ResourceSize = 0;
+  uint64_t                   m_PayloadLeft = 0;
+};
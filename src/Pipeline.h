@@ -0,0 +1,184 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+// Shared cap on the bytes held by all pipeline stages. Only the first stage
+// blocks in Acquire, later stages account with ForceAcquire so they can
+// never wait on memory that only they could release.
+class ByteBudget
+{
+public: // Construction
+
+  explicit ByteBudget(
+      uint64_t _Limit
+    )
+    : m_Limit(_Limit)
+  {
+  }
+
+public: // Interface
+
+  void Acquire(
+      uint64_t _Size
+    )
+  {
+    std::unique_lock Lock(m_Mutex);
+
+    // An item larger than the whole budget still goes through, alone
+    m_Condition.wait(Lock, [&] { return m_InFlight == 0 || m_InFlight + _Size <= m_Limit; });
+
+    Add(_Size);
+  }
+
+  void ForceAcquire(
+      uint64_t _Size
+    )
+  {
+    std::lock_guard Lock(m_Mutex);
+    Add(_Size);
+  }
+
+  void Release(
+      uint64_t _Size
+    )
+  {
+    {
+      std::lock_guard Lock(m_Mutex);
+      m_InFlight -= std::min(_Size, m_InFlight);
+    }
+
+    m_Condition.notify_all();
+  }
+
+  uint64_t GetPeak() const
+  {
+    return m_Peak;
+  }
+
+protected: // Service
+
+  void Add(
+      uint64_t _Size
+    )
+  {
+    m_InFlight += _Size;
+    m_Peak      = std::max(m_Peak, m_InFlight);
+  }
+
+protected: // Members
+
+  std::mutex              m_Mutex;
+  std::condition_variable m_Condition;
+  uint64_t                m_Limit;
+  uint64_t                m_InFlight = 0;
+  uint64_t                m_Peak = 0;
+};
+
+// Multi producer, multi consumer FIFO. Pop returns false once the queue is
+// closed and drained.
+template <typename T>
+class WorkQueue
+{
+public: // Interface
+
+  void Push(
+      T _Item
+    )
+  {
+    {
+      std::lock_guard Lock(m_Mutex);
+      m_Items.push_back(std::move(_Item));
+    }
+
+    m_Condition.notify_one();
+  }
+
+  bool Pop(
+      T & _Item
+    )
+  {
+    std::unique_lock Lock(m_Mutex);
+    m_Condition.wait(Lock, [&] { return m_Closed || !m_Items.empty(); });
+
+    if (m_Items.empty())
+      return false;
+
+    _Item = std::move(m_Items.front());
+    m_Items.pop_front();
+
+    return true;
+  }
+
+  void Close()
+  {
+    {
+      std::lock_guard Lock(m_Mutex);
+      m_Closed = true;
+    }
+
+    m_Condition.notify_all();
+  }
+
+protected: // Members
+
+  std::mutex              m_Mutex;
+  std::condition_variable m_Condition;
+  std::deque<T>           m_Items;
+  bool                    m_Closed = false;
+};
+
+// Recycles byte buffers between stages so steady state runs allocation free.
+// Keeps at most _Limit bytes of spare capacity around.
+class BufferPool
+{
+public: // Construction
+
+  explicit BufferPool(
+      uint64_t _Limit
+    )
+    : m_Limit(_Limit)
+  {
+  }
+
+public: // Interface
+
+  std::vector<unsigned char> Get()
+  {
+    std::lock_guard Lock(m_Mutex);
+
+    if (m_Buffers.empty())
+      return {};
+
+    std::vector<unsigned char> Buffer = std::move(m_Buffers.back());
+    m_Buffers.pop_back();
+    m_Size -= Buffer.capacity();
+
+    return Buffer;
+  }
+
+  void Put(
+      std::vector<unsigned char> _Buffer
+    )
+  {
+    _Buffer.clear();
+
+    std::lock_guard Lock(m_Mutex);
+
+    if (m_Size + _Buffer.capacity() > m_Limit)
+      return;
+
+    m_Size += _Buffer.capacity();
+    m_Buffers.push_back(std::move(_Buffer));
+  }
+
+protected: // Members
+
+  std::mutex                              m_Mutex;
+  std::vector<std::vector<unsigned char>> m_Buffers;
+  uint64_t                                m_Limit;
+  uint64_t                                m_Size = 0;
+};
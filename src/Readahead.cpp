@@ -0,0 +1,141 @@
+#include "Readahead.h"
+
+#include <algorithm>
+
+namespace
+{
+  constexpr uint64_t COMPRESSED_CHUNK_MAX_SIZE = 65536;
+  constexpr uint64_t TOUCH_STRIDE              = 4096;
+}
+
+//
+// Construction
+//
+
+Readahead::~Readahead()
+{
+  {
+    std::lock_guard Lock(m_Mutex);
+    m_Stopping = true;
+  }
+
+  m_Condition.notify_all();
+
+  if (m_Thread.joinable())
+    m_Thread.join();
+}
+
+//
+// Interface
+//
+
+void Readahead::SetSegments(
+    uint32_t _Segments
+  )
+{
+  m_Segments = _Segments;
+}
+
+void Readahead::Attach(
+    const MappedFile & _File
+  )
+{
+  Detach();
+
+  if (m_Segments == 0)
+    return;
+
+  _File.AdviseSequential();
+
+  {
+    std::lock_guard Lock(m_Mutex);
+
+    m_File    = &_File;
+    m_Target  = 0;
+    m_Fetched = 0;
+  }
+
+  if (!m_Thread.joinable())
+    m_Thread = std::thread(&Readahead::PrefetchLoop, this);
+}
+
+void Readahead::Advance(
+    uint64_t _Offset
+  )
+{
+  {
+    std::lock_guard Lock(m_Mutex);
+
+    if (!m_File)
+      return;
+
+    // A compressed segment never takes more than its size field plus a full segment
+    const uint64_t Window = m_Segments * (COMPRESSED_CHUNK_MAX_SIZE + sizeof(uint32_t));
+
+    m_Target  = std::min(_Offset + Window, m_File->GetSize());
+    m_Fetched = std::max(m_Fetched, _Offset);
+
+    if (m_Fetched >= m_Target)
+      return;
+  }
+
+  m_Condition.notify_all();
+}
+
+void Readahead::Detach()
+{
+  std::unique_lock Lock(m_Mutex);
+
+  m_File = nullptr;
+  m_Condition.wait(Lock, [this] { return !m_Busy; });
+}
+
+//
+// Service
+//
+
+void Readahead::PrefetchLoop()
+{
+  for (;;)
+  {
+    const MappedFile * File = nullptr;
+    uint64_t           Begin = 0;
+    uint64_t           End = 0;
+
+    {
+      std::unique_lock Lock(m_Mutex);
+      m_Condition.wait(Lock, [this] { return m_Stopping || (m_File && m_Fetched < m_Target); });
+
+      if (m_Stopping)
+        return;
+
+      File   = m_File;
+      Begin  = m_Fetched;
+      End    = m_Target;
+      m_Busy = true;
+    }
+
+    File->WillNeed(Begin, End - Begin);
+
+    // The hint is advisory only, touching every page makes the range resident
+    // here instead of stalling the reader on a page fault
+    const unsigned char * Data = File->GetData();
+    unsigned char         Sum  = 0;
+
+    for (uint64_t Offset = Begin; Offset < End; Offset += TOUCH_STRIDE)
+      Sum ^= *static_cast<const volatile unsigned char *>(Data + Offset);
+
+    Sum ^= *static_cast<const volatile unsigned char *>(Data + End - 1);
+
+    static_cast<void>(Sum);
+
+    {
+      std::lock_guard Lock(m_Mutex);
+
+      m_Busy    = false;
+      m_Fetched = std::max(m_Fetched, End);
+    }
+
+    m_Condition.notify_all();
+  }
+}
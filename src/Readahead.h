@@ -0,0 +1,64 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "MappedFile.h"
+
+// Keeps the compressed bytes ahead of a sequential segment reader resident.
+// The kernel is told about the access pattern, and a background thread
+// faults in the next K segments while the caller inflates the current one,
+// so a slow read never stalls the inflate loop.
+class Readahead
+{
+public: // Constants
+
+  // Off until it measurably helps, on local disks the kernel readahead was
+  // as fast with a hot page cache and faster with a cold one
+  static constexpr uint32_t DEFAULT_SEGMENTS = 0;
+
+public: // Construction
+
+  Readahead() = default;
+  ~Readahead();
+
+  Readahead(const Readahead &) = delete;
+  Readahead & operator=(const Readahead &) = delete;
+
+public: // Interface
+
+  // Zero disables prefetching
+  void SetSegments(
+      uint32_t _Segments
+    );
+
+  void Attach(
+      const MappedFile & _File
+    );
+
+  // The reader got to _Offset, everything up to K segments past it is fetched
+  void Advance(
+      uint64_t _Offset
+    );
+
+  // Waits for the prefetch thread to leave the mapping before it goes away
+  void Detach();
+
+protected: // Service
+
+  void PrefetchLoop();
+
+protected: // Members
+
+  uint32_t                m_Segments = DEFAULT_SEGMENTS;
+
+  std::thread             m_Thread;
+  std::mutex              m_Mutex;
+  std::condition_variable m_Condition;
+  const MappedFile *      m_File = nullptr;
+  uint64_t                m_Target = 0;   // Fetch up to here
+  uint64_t                m_Fetched = 0;  // Resident up to here
+  bool                    m_Busy = false; // Prefetch thread is touching m_File
+  bool                    m_Stopping = false;
+};
@@ -0,0 +1,116 @@
+#include "ResourceFilter.h"
+
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <charconv>
+#include <cctype>
+
+#include "MurmurHash2/MurmurHash2.h"
+
+//
+// Interface
+//
+
+void ResourceFilter::IncludeType(
+    const std::string & _Type
+  )
+{
+  m_IncludedTypes.insert(ParseTypeHash(_Type));
+}
+
+void ResourceFilter::ExcludeType(
+    const std::string & _Type
+  )
+{
+  m_ExcludedTypes.insert(ParseTypeHash(_Type));
+}
+
+void ResourceFilter::IncludeName(
+    uint64_t _NameHash
+  )
+{
+  m_IncludedNames.insert(_NameHash);
+}
+
+bool ResourceFilter::IncludeNamesFromFile(
+    const std::string & _FileName
+  )
+{
+  std::ifstream File(_FileName);
+
+  if (!File.is_open())
+    return false;
+
+  uint64_t LineNumber = 0;
+
+  for (std::string Line; std::getline(File, Line); )
+  {
+    ++LineNumber;
+
+    // Names files may come with CRLF line endings or trailing blanks
+    Line.erase(std::find_if(Line.rbegin(), Line.rend(), [](char _Char)
+    {
+      return !std::isspace(static_cast<unsigned char>(_Char));
+    }).base(), Line.end());
+
+    if (Line.empty() || !std::isdigit(static_cast<unsigned char>(Line.front())))
+      continue;
+
+    uint64_t NameHash = 0;
+
+    if (ParseNameHash(Line, NameHash))
+      IncludeName(NameHash);
+    else
+      std::cerr << _FileName << ":" << LineNumber << ": invalid name hash " << Line << std::endl;
+  }
+
+  return true;
+}
+
+bool ResourceFilter::ParseNameHash(
+    const std::string & _Text,
+    uint64_t &          _NameHash
+  )
+{
+  const char * End = _Text.data() + _Text.size();
+  const auto   Result = std::from_chars(_Text.data(), End, _NameHash);
+
+  return !_Text.empty() && Result.ec == std::errc() && Result.ptr == End;
+}
+
+bool ResourceFilter::IsEmpty() const
+{
+  return m_IncludedTypes.empty() && m_ExcludedTypes.empty() && m_IncludedNames.empty();
+}
+
+bool ResourceFilter::Matches(
+    uint64_t _TypeHash,
+    uint64_t _NameHash
+  ) const
+{
+  if (!m_IncludedTypes.empty() && !m_IncludedTypes.count(_TypeHash))
+    return false;
+
+  if (m_ExcludedTypes.count(_TypeHash))
+    return false;
+
+  return m_IncludedNames.empty() || m_IncludedNames.count(_NameHash);
+}
+
+//
+// Service
+//
+
+uint64_t ResourceFilter::ParseTypeHash(
+    const std::string & _Type
+  )
+{
+  uint64_t TypeHash = 0;
+
+  // Anything that isn't a decimal hash, out of range numbers included, is a type name
+  if (ParseNameHash(_Type, TypeHash))
+    return TypeHash;
+
+  return MurmurHash64A(_Type.c_str(), static_cast<int>(_Type.length()), 0);
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <string>
+#include <set>
+#include <cstdint>
+
+// Include / exclude rules on (TypeHash, NameHash) for selective extraction.
+// Types are given by name or by decimal hash, names by decimal hash.
+class ResourceFilter
+{
+public: // Interface
+
+  void IncludeType(
+      const std::string & _Type
+    );
+
+  void ExcludeType(
+      const std::string & _Type
+    );
+
+  void IncludeName(
+      uint64_t _NameHash
+    );
+
+  // One decimal name hash per line, malformed ones are reported and skipped
+  bool IncludeNamesFromFile(
+      const std::string & _FileName
+    );
+
+  // Whole string as a decimal 64 bit hash
+  static bool ParseNameHash(
+      const std::string & _Text,
+      uint64_t &          _NameHash
+    );
+
+  bool IsEmpty() const;
+
+  bool Matches(
+      uint64_t _TypeHash,
+      uint64_t _NameHash
+    ) const;
+
+protected: // Service
+
+  static uint64_t ParseTypeHash(
+      const std::string & _Type
+    );
+
+protected: // Members
+
+  std::set<uint64_t> m_IncludedTypes;
+  std::set<uint64_t> m_ExcludedTypes;
+  std::set<uint64_t> m_IncludedNames;
+};
@@ -0,0 +1,370 @@
+#include "ResourceServer.h"
+
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+#include <cstring>
+#include <csignal>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#include "Pipeline.h"
+
+namespace
+{
+  bool SendAll(int _Socket, const void * _Data, size_t _Size, int _Flags = 0)
+  {
+    const auto * Data = static_cast<const char *>(_Data);
+
+    while (_Size > 0)
+    {
+      const ssize_t Sent = send(_Socket, Data, _Size, _Flags | MSG_NOSIGNAL);
+
+      if (Sent <= 0)
+        return false;
+
+      Data  += Sent;
+      _Size -= Sent;
+    }
+
+    return true;
+  }
+
+  // Set by SIGINT / SIGTERM, which also wake the poll loop through its pipe
+  volatile std::sig_atomic_t Stopping   = 0;
+  int                        StopWakeUp = -1;
+
+  void OnStopSignal(int)
+  {
+    Stopping = 1;
+
+    const char Byte = 0;
+    static_cast<void>(write(StopWakeUp, &Byte, sizeof(Byte)));
+  }
+}
+
+//
+// Interface
+//
+
+bool ResourceServer::Load(
+    const std::string & _Folder,
+    const std::string & _HeaderCacheFile
+  )
+{
+  // Indexed closed, a folder may hold more bundles than descriptors are allowed
+  if (!m_Headers.IndexFolder(_Folder, _HeaderCacheFile, &m_Cache, m_Bundles))
+    return false;
+
+  for (const auto & Bundle : m_Bundles)
+  {
+    for (const auto & Resource : Bundle->GetResources())
+      m_Resources.emplace(std::pair{ Resource.TypeHash, Resource.NameHash }, Location{ Bundle.get(), &Resource });
+  }
+
+  std::cout << m_Resources.size() << " resources in " << m_Bundles.size() << " bundles" << std::endl;
+
+  return true;
+}
+
+bool ResourceServer::Serve(
+    const std::string & _SocketPath,
+    uint32_t            _ThreadCount
+  )
+{
+  sockaddr_un Address{};
+  Address.sun_family = AF_UNIX;
+
+  if (_SocketPath.size() >= sizeof(Address.sun_path))
+    return false;
+
+  std::strcpy(Address.sun_path, _SocketPath.c_str());
+
+  const int Listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (Listener < 0)
+    return false;
+
+  unlink(_SocketPath.c_str());
+
+  // Workers hand served connections back to the poll loop through this pipe
+  int Wake[2] = { -1, -1 };
+
+  if (bind(Listener, reinterpret_cast<const sockaddr *>(&Address), sizeof(Address)) != 0 ||
+      listen(Listener, SOMAXCONN) != 0 || pipe(Wake) != 0)
+  {
+    close(Listener);
+    return false;
+  }
+
+  fcntl(Listener, F_SETFL, fcntl(Listener, F_GETFL) | O_NONBLOCK);
+  fcntl(Wake[0], F_SETFL, fcntl(Wake[0], F_GETFL) | O_NONBLOCK);
+  fcntl(Wake[1], F_SETFL, fcntl(Wake[1], F_GETFL) | O_NONBLOCK);
+
+  // sendfile reports a closed peer through SIGPIPE otherwise
+  std::signal(SIGPIPE, SIG_IGN);
+
+  struct sigaction Stop{};
+  struct sigaction PreviousInterrupt{};
+  struct sigaction PreviousTerminate{};
+
+  Stopping   = 0;
+  StopWakeUp = Wake[1];
+
+  Stop.sa_handler = OnStopSignal;
+  sigemptyset(&Stop.sa_mask);
+
+  sigaction(SIGINT, &Stop, &PreviousInterrupt);
+  sigaction(SIGTERM, &Stop, &PreviousTerminate);
+
+  if (_ThreadCount == 0)
+    _ThreadCount = std::max(1u, std::thread::hardware_concurrency());
+
+  WorkQueue<Connection *>   Ready;
+  std::mutex                Mutex;
+  std::vector<Connection *> Served;
+
+  std::vector<std::thread> Workers;
+
+  for (uint32_t i = 0; i < _ThreadCount; ++i)
+  {
+    Workers.emplace_back([&]
+    {
+      Connection * Client = nullptr;
+
+      while (Ready.Pop(Client))
+      {
+        if (!ServeRequest(*Client))
+        {
+          close(Client->Socket);
+          delete Client;
+          continue;
+        }
+
+        {
+          std::lock_guard Lock(Mutex);
+          Served.push_back(Client);
+        }
+
+        // A full pipe already has a wake up pending
+        const char Byte = 0;
+        static_cast<void>(write(Wake[1], &Byte, sizeof(Byte)));
+      }
+    });
+  }
+
+  std::cout << "Listening on " << _SocketPath << " with " << _ThreadCount << " threads" << std::endl;
+
+  std::vector<Connection *> Idle;
+  std::vector<pollfd>       Polled;
+  bool                      Listening = true;
+
+  while (Listening && !Stopping)
+  {
+    Polled.clear();
+    Polled.push_back(pollfd{ Listener, POLLIN, 0 });
+    Polled.push_back(pollfd{ Wake[0], POLLIN, 0 });
+
+    for (const Connection * Client : Idle)
+      Polled.push_back(pollfd{ Client->Socket, POLLIN, 0 });
+
+    if (poll(Polled.data(), Polled.size(), -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+
+      break;
+    }
+
+    if (Stopping)
+      break;
+
+    // A readable connection leaves the poll set until its request is served,
+    // with more requests waiting it comes back and queues behind the others
+    size_t Kept = 0;
+
+    for (size_t i = 0; i < Idle.size(); ++i)
+    {
+      if (Polled[i + 2].revents != 0)
+        Ready.Push(Idle[i]);
+      else
+        Idle[Kept++] = Idle[i];
+    }
+
+    Idle.resize(Kept);
+
+    if (Polled[1].revents != 0)
+    {
+      char Bytes[256];
+
+      while (read(Wake[0], Bytes, sizeof(Bytes)) > 0)
+        ;
+
+      std::lock_guard Lock(Mutex);
+
+      Idle.insert(Idle.end(), Served.begin(), Served.end());
+      Served.clear();
+    }
+
+    if (Polled[0].revents == 0)
+      continue;
+
+    for (;;)
+    {
+      const int Client = accept(Listener, nullptr, nullptr);
+
+      if (Client < 0)
+      {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+          Listening = false;
+
+        break;
+      }
+
+      // Replies are sent blocking, but a client that stops reading only holds a worker for so long
+      const timeval SendTimeout{ 30, 0 };
+
+      fcntl(Client, F_SETFL, fcntl(Client, F_GETFL) & ~O_NONBLOCK);
+      setsockopt(Client, SOL_SOCKET, SO_SNDTIMEO, &SendTimeout, sizeof(SendTimeout));
+
+      Idle.push_back(new Connection{ Client, {}, 0 });
+    }
+  }
+
+  Ready.Close();
+
+  for (auto & Worker : Workers)
+    Worker.join();
+
+  Idle.insert(Idle.end(), Served.begin(), Served.end());
+
+  for (Connection * Client : Idle)
+  {
+    close(Client->Socket);
+    delete Client;
+  }
+
+  sigaction(SIGINT, &PreviousInterrupt, nullptr);
+  sigaction(SIGTERM, &PreviousTerminate, nullptr);
+
+  close(Wake[0]);
+  close(Wake[1]);
+  close(Listener);
+  unlink(_SocketPath.c_str());
+
+  if (Stopping)
+    std::cout << "Stopped, removed " << _SocketPath << std::endl;
+
+  return true;
+}
+
+//
+// Service
+//
+
+bool ResourceServer::ServeRequest(
+    Connection & _Connection
+  )
+{
+  while (_Connection.PendingSize < sizeof(Request))
+  {
+    const ssize_t Received = recv(_Connection.Socket, _Connection.Pending + _Connection.PendingSize, sizeof(Request) - _Connection.PendingSize, MSG_DONTWAIT);
+
+    if (Received > 0)
+    {
+      _Connection.PendingSize += Received;
+      continue;
+    }
+
+    // Only part of a request so far, the rest is waited for in the poll loop
+    return Received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+  }
+
+  Request Item;
+  std::memcpy(&Item, _Connection.Pending, sizeof(Item));
+  _Connection.PendingSize = 0;
+
+  const auto it = m_Resources.find(std::pair{ Item.TypeHash, Item.NameHash });
+
+  if (it == m_Resources.end())
+  {
+    const int64_t NotFound = -1;
+    return SendAll(_Connection.Socket, &NotFound, sizeof(NotFound));
+  }
+
+  BundleIndex & Bundle = *it->second.Bundle;
+
+  if (!m_OpenBundles.Acquire(Bundle))
+  {
+    const int64_t NotFound = -1;
+    return SendAll(_Connection.Socket, &NotFound, sizeof(NotFound));
+  }
+
+  const bool Sent = SendResource(_Connection.Socket, Bundle, *it->second.Resource);
+  m_OpenBundles.Release(Bundle);
+
+  return Sent;
+}
+
+bool ResourceServer::SendResource(
+    int                           _Socket,
+    const BundleIndex &           _Bundle,
+    const BundleIndex::Resource & _Resource
+  )
+{
+  const int64_t  Size      = static_cast<int64_t>(_Resource.Size);
+  const uint32_t First     = static_cast<uint32_t>(_Resource.Offset / BundleIndex::SEGMENT_SIZE);
+  const uint32_t Last      = static_cast<uint32_t>((_Resource.Offset + std::max<uint64_t>(_Resource.Size, 1) - 1) / BundleIndex::SEGMENT_SIZE);
+
+#ifdef __linux__
+
+  // A resource sitting inside one stored segment is a plain byte range of
+  // the bundle file, let the kernel copy it from the page cache
+  if (First == Last && Size > 0 && _Bundle.IsStored(First))
+  {
+    if (!SendAll(_Socket, &Size, sizeof(Size), MSG_MORE))
+      return false;
+
+    off_t    FileOffset = _Bundle.GetSegments()[First].Offset + _Resource.Offset % BundleIndex::SEGMENT_SIZE;
+    uint64_t Remaining  = _Resource.Size;
+
+    while (Remaining > 0)
+    {
+      const ssize_t Sent = sendfile(_Socket, _Bundle.GetFile().GetDescriptor(), &FileOffset, Remaining);
+
+      if (Sent <= 0)
+        return false;
+
+      Remaining -= Sent;
+    }
+
+    return true;
+  }
+
+#endif
+
+  // Size prefix and payload go out in one send
+  thread_local std::vector<unsigned char> Buffer;
+  Buffer.resize(sizeof(Size) + _Resource.Size);
+
+  std::memcpy(Buffer.data(), &Size, sizeof(Size));
+
+  if (!_Bundle.Read(_Resource.Offset, Buffer.data() + sizeof(Size), _Resource.Size))
+  {
+    const int64_t NotFound = -1;
+    return SendAll(_Socket, &NotFound, sizeof(NotFound));
+  }
+
+  return SendAll(_Socket, Buffer.data(), Buffer.size());
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <cstdint>
+
+#include "BundleIndex.h"
+#include "SegmentCache.h"
+#include "HeaderCache.h"
+#include "OpenBundleCache.h"
+
+// Long running resolver for (TypeHash, NameHash) -> bytes over a Unix socket.
+// Idle connections are polled on one thread and the worker pool serves one
+// request at a time, so long lived clients never hold a worker between requests.
+// Bundles are only mapped while recently used, and SIGINT / SIGTERM stop the
+// server and remove its socket.
+//
+// Protocol, all values little endian, any number of requests per connection:
+//   request  : uint64_t TypeHash, uint64_t NameHash
+//   response : int64_t  Size (-1 when unknown), followed by Size bytes
+class ResourceServer
+{
+public: // Interface
+
+  // A non empty _HeaderCacheFile is used and refreshed to skip bundle scanning
+  bool Load(
+      const std::string & _Folder,
+      const std::string & _HeaderCacheFile = ""
+    );
+
+  // Returns once SIGINT or SIGTERM is received
+  bool Serve(
+      const std::string & _SocketPath,
+      uint32_t            _ThreadCount = 0
+    );
+
+protected: // Types
+
+  struct Request
+  {
+    uint64_t TypeHash;
+    uint64_t NameHash;
+  };
+
+  // Owned by the poll loop while idle and by one worker while it is served
+  struct Connection
+  {
+    int           Socket;
+    unsigned char Pending[sizeof(Request)];
+    size_t        PendingSize = 0;
+  };
+
+protected: // Service
+
+  // Serves at most one request, false once the connection is closed or broken
+  bool ServeRequest(
+      Connection & _Connection
+    );
+
+  bool SendResource(
+      int                           _Socket,
+      const BundleIndex &           _Bundle,
+      const BundleIndex::Resource & _Resource
+    );
+
+protected: // Members
+
+  struct Location
+  {
+    BundleIndex *                 Bundle;
+    const BundleIndex::Resource * Resource;
+  };
+
+  SegmentCache                                        m_Cache;
+  OpenBundleCache                                     m_OpenBundles;
+  HeaderCache                                         m_Headers;
+  std::vector<std::unique_ptr<BundleIndex>>           m_Bundles;
+  std::map<std::pair<uint64_t, uint64_t>, Location>   m_Resources;
+};
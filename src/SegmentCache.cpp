@@ -0,0 +1,68 @@
+#include "SegmentCache.h"
+
+//
+// Construction
+//
+
+SegmentCache::SegmentCache(
+    uint64_t _Capacity
+  )
+  : m_Capacity(_Capacity)
+{
+}
+
+//
+// Interface
+//
+
+SegmentCache::Segment SegmentCache::Find(
+    uint64_t _Owner,
+    uint32_t _Index
+  )
+{
+  std::lock_guard Lock(m_Mutex);
+
+  const auto it = m_Lookup.find(Key{ _Owner, _Index });
+
+  if (it == m_Lookup.end())
+    return nullptr;
+
+  m_Entries.splice(m_Entries.begin(), m_Entries, it->second);
+
+  return it->second->second;
+}
+
+void SegmentCache::Insert(
+    uint64_t _Owner,
+    uint32_t _Index,
+    Segment  _Segment
+  )
+{
+  std::lock_guard Lock(m_Mutex);
+
+  const Key EntryKey{ _Owner, _Index };
+
+  // Another thread may have inflated the same segment meanwhile
+  if (m_Lookup.count(EntryKey))
+    return;
+
+  m_Size += _Segment->size();
+  m_Entries.emplace_front(EntryKey, std::move(_Segment));
+  m_Lookup[EntryKey] = m_Entries.begin();
+
+  while (m_Size > m_Capacity && m_Entries.size() > 1)
+  {
+    m_Size -= m_Entries.back().second->size();
+    m_Lookup.erase(m_Entries.back().first);
+    m_Entries.pop_back();
+  }
+}
+
+void SegmentCache::Clear()
+{
+  std::lock_guard Lock(m_Mutex);
+
+  m_Lookup.clear();
+  m_Entries.clear();
+  m_Size = 0;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Thread safe LRU cache of inflated segments, shared between bundles.
+// Owners are ids that are never reused, unlike the address of an index.
+class SegmentCache
+{
+public: // Types
+
+  using Segment = std::shared_ptr<const std::vector<unsigned char>>;
+
+public: // Construction
+
+  explicit SegmentCache(
+      uint64_t _Capacity = 256ull * 1024 * 1024
+    );
+
+public: // Interface
+
+  Segment Find(
+      uint64_t _Owner,
+      uint32_t _Index
+    );
+
+  void Insert(
+      uint64_t _Owner,
+      uint32_t _Index,
+      Segment  _Segment
+    );
+
+  void Clear();
+
+protected: // Members
+
+  using Key   = std::pair<uint64_t, uint32_t>;
+  using Entry = std::pair<Key, Segment>;
+
+  std::mutex                                      m_Mutex;
+  std::list<Entry>                                m_Entries; // Most recently used first
+  std::map<Key, std::list<Entry>::iterator>       m_Lookup;
+  uint64_t                                        m_Capacity;
+  uint64_t                                        m_Size = 0;
+};
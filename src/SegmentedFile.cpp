@@ -6,14 +6,29 @@
 #include <cassert>
 #include <map>
 #include <array>
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <iostream>
 
 #include "MurmurHash2/MurmurHash2.h"
+#include "Pipeline.h"
 
 namespace utility
 {
   constexpr size_t COMPRESSED_HEADER_SIZE = 12;
   constexpr size_t COMPRESSED_CHUNK_MAX_SIZE = 65536;
   constexpr size_t BITSQUID_PACKAGE_HEADER_SIZE = 256;
+  constexpr uint64_t RESOURCE_CHUNK_MAX_SIZE = 1ull << 30;
+  constexpr size_t SEGMENTS_PER_THREAD_BATCH = 16;
+
+  // Spelled out instead of deflateInit defaults so a zlib built with other defaults still uses these.
+  // Output is only byte identical between builds linked against the same zlib version.
+  constexpr int DEFLATE_LEVEL = 6;
+  constexpr int DEFLATE_WINDOW_BITS = 15;
+  constexpr int DEFLATE_MEM_LEVEL = 8;
   constexpr uint8_t records_header[] = {0x0D, 0x61, 0xEB, 0x8E, 0x03, 0xEE, 0xD3, 0x92, 0x3D, 0x40, 0x19, 0x7E, 0xD1, 0xB5, 0xD7, 0xBB, 0x62, 0xD2, 0xF5, 0x13, 0x78, 0x25, 0xE1, 0x11, 0xDF, 0xDE, 0x6A, 0x87, 0x97, 0xB4, 0xC0, 0xEA, 0xD1, 0x9F, 0x14, 0x4E, 0xCD, 0x1A, 0xFB, 0xE2, 0xF4, 0x6C, 0x16, 0x55, 0xAA, 0x57, 0x88, 0x0F, 0xE4, 0x26, 0x23, 0xDC, 0x1F, 0xF6, 0xA0, 0xFE, 0x24, 0xD6, 0x32, 0x37, 0xD1, 0xB4, 0x8F, 0xAA, 0xAA, 0x4F, 0x98, 0xF7, 0x42, 0x68, 0x80, 0x31, 0x66, 0x7F, 0x95, 0x77, 0xED, 0x18, 0xBB, 0xC5, 0x44, 0x2C, 0x43, 0x07, 0xEC, 0xC3, 0x39, 0xBA, 0x2D, 0x97, 0x4D, 0x46, 0x39, 0x7D, 0xA3, 0xC8, 0xD7, 0x42, 0x52, 0xFC, 0x2E, 0x2F, 0x5E, 0xA9, 0x44, 0x0A, 0x3A, 0xC4, 0x68, 0xCC, 0xF9, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 
   static std::array<std::pair<std::string, std::string>, 41> BitsquidResourceNames
@@ -90,8 +105,9 @@ namespace utility
     if ((result = inflate(&z, Z_FINISH)) != Z_STREAM_END)
     {
 
-      /* something on zlib decompression failed. */
-      return result;
+      /* something on zlib decompression failed, a truncated stream is an error too. */
+      inflateEnd(&z);
+      return result < 0 ? result : Z_DATA_ERROR;
     }
 
     /* save transferred bytes. */
@@ -109,7 +125,7 @@ namespace utility
     return tb;
   }
 
-  int32_t ZlibCompress(uint8_t * in_buf, uint32_t in_size, uint8_t * out_buf, uint32_t out_size)
+  int32_t ZlibCompress(const uint8_t * in_buf, uint32_t in_size, uint8_t * out_buf, uint32_t out_size)
   {
     int32_t result = 0;
     int32_t tb = 0;
@@ -129,18 +145,19 @@ namespace utility
     z.zalloc    = NULL;
     z.zfree    = NULL;
 
-    /* initialize the decompression structure, storm.dll uses zlib version 1.1.3. */
-    if ((result = deflateInit(&z, Z_DEFAULT_COMPRESSION)) != Z_OK)
+    /* initialize the compression structure with pinned parameters. */
+    if ((result = deflateInit2(&z, DEFLATE_LEVEL, Z_DEFLATED, DEFLATE_WINDOW_BITS, DEFLATE_MEM_LEVEL, Z_DEFAULT_STRATEGY)) != Z_OK)
     {
       /* something on zlib initialization failed. */
       return result;
     }
 
-    /* call zlib to decompress the data. */
+    /* call zlib to compress the data. */
     if ((result = deflate(&z, Z_FINISH)) != Z_STREAM_END)
     {
-      /* something on zlib decompression failed. */
-      return result;
+      /* something on zlib compression failed. */
+      deflateEnd(&z);
+      return result < 0 ? result : Z_BUF_ERROR;
     }
 
     /* save transferred bytes. */
@@ -170,9 +187,7 @@ bool SegmentedFile::Decompress(
   if (!std::filesystem::exists(_InputFile))
     return false;
 
-  UnpackBitsquidPackage(ReadSegmentCompressedFile(_InputFile), _OutFolder);
-  
-  return true;
+  return UnpackBitsquidPackage(ReadSegmentCompressedFile(_InputFile), _OutFolder) >= 0;
 }
 
 bool SegmentedFile::Compress(
@@ -183,8 +198,6 @@ bool SegmentedFile::Compress(
   if (!std::filesystem::exists(_Folder) || !std::filesystem::is_directory(_Folder))
     return false;
 
-  std::vector<char> Data;
-
   const auto IsHash = [](const std::string & _Data) -> bool
   {
     return std::all_of(_Data.cbegin(), _Data.cend(), [](char _Char)
@@ -201,13 +214,13 @@ bool SegmentedFile::Compress(
 
     struct Chunk
     {
-      int32_t _;
-      int32_t FileSize;
-      int32_t FileSizeHighBits;
+      int32_t  _;
+      uint32_t FileSize;
+      uint32_t StreamSize;
     };
 
-    std::vector<Chunk>          Chunks;
-    std::vector<unsigned char>  Data;
+    std::vector<Chunk>  Chunks;
+    std::string         FileName;
   };
 
   std::vector<Record> Records;
@@ -217,6 +230,12 @@ bool SegmentedFile::Compress(
     if (std::filesystem::is_directory(DirectoryEntry))
       continue;
 
+    if (m_Deterministic && !std::filesystem::is_regular_file(DirectoryEntry))
+    {
+      std::cerr << "Not a regular file " << DirectoryEntry.path().string() << std::endl;
+      return false;
+    }
+
     Record Record;
 
     // For now assume names are always hashes
@@ -230,22 +249,40 @@ bool SegmentedFile::Compress(
     else
       Record.TypeHash = MurmurHash64A(Extention.c_str(), ExtentionName.length(), 0);
 
-    // For now assume there's only 1 chunk for each file
-    Record.Chunks     = std::vector{Record::Chunk{ 0, (int32_t)std::filesystem::file_size(DirectoryEntry), 0 }};
-    Record.ChunkCount = Record.Chunks.size();
+    // Large resources are split so no chunk exceeds RESOURCE_CHUNK_MAX_SIZE, chunk sizes are 32-bit
+    const uint64_t FileSize = std::filesystem::file_size(DirectoryEntry);
+
+    for (uint64_t Offset = 0; Offset < FileSize || Record.Chunks.empty(); Offset += utility::RESOURCE_CHUNK_MAX_SIZE)
+    {
+      const uint64_t ChunkSize = std::min(FileSize - Offset, utility::RESOURCE_CHUNK_MAX_SIZE);
+
+      Record.Chunks.push_back(Record::Chunk{ 0, static_cast<uint32_t>(ChunkSize), 0 });
+    }
 
-    Record.Data.resize(std::filesystem::file_size(DirectoryEntry));
-    std::ifstream(DirectoryEntry.path().string(), std::ios::binary).read((char *)Record.Data.data(), Record.Data.size());
+    Record.ChunkCount = Record.Chunks.size();
+    Record.FileName   = DirectoryEntry.path().string();
     
     Records.push_back(std::move(Record));
   }
 
-  // Sort because Bitsquid sorts it
+  // Sort because Bitsquid sorts it, the file name breaks ties so the
+  // directory iteration order never leaks into the bundle
   std::sort(Records.begin(), Records.end(), [](const Record & lhs, const Record & rhs)
   {
-    return std::tie(lhs.TypeHash, lhs.NameHash) < std::tie(rhs.TypeHash, rhs.NameHash);
+    return std::tie(lhs.TypeHash, lhs.NameHash, lhs.FileName) < std::tie(rhs.TypeHash, rhs.NameHash, rhs.FileName);
   });
 
+  const auto Duplicate = std::adjacent_find(Records.begin(), Records.end(), [](const Record & lhs, const Record & rhs)
+  {
+    return lhs.TypeHash == rhs.TypeHash && lhs.NameHash == rhs.NameHash;
+  });
+
+  if (m_Deterministic && Duplicate != Records.end())
+  {
+    std::cerr << "Ambiguous resource " << Duplicate->FileName << " and " << std::next(Duplicate)->FileName << std::endl;
+    return false;
+  }
+
   std::ofstream OutFile(_OutputFile, std::ios::binary);
 
   uint32_t RecordsCount = Records.size();
@@ -273,25 +310,59 @@ bool SegmentedFile::Compress(
     {
       OutFile.write((const char *)&Chunk._, sizeof(Chunk._));
       OutFile.write((const char *)&Chunk.FileSize, sizeof(Chunk.FileSize));
-      OutFile.write((const char *)&Chunk.FileSizeHighBits, sizeof(Chunk.FileSizeHighBits));
+      OutFile.write((const char *)&Chunk.StreamSize, sizeof(Chunk.StreamSize));
     }
 
-    for (const auto & Chunk : Record.Chunks)
-      OutFile.write((char*)Record.Data.data(), Record.Data.size());
+    // Chunks are laid out back to back, stream the whole file instead of holding it
+    if (std::filesystem::file_size(Record.FileName) > 0)
+      OutFile << std::ifstream(Record.FileName, std::ios::binary).rdbuf();
   }
 
   OutFile.close();
 
-  std::vector<unsigned char> FileData;
-  FileData.resize(std::filesystem::file_size(_OutputFile));
-
-  std::ifstream(_OutputFile, std::ios::binary).read((char *)FileData.data(), FileData.size());
+  std::ifstream Package(_OutputFile, std::ios::binary);
 
-  WriteFileSegmentCompressed(FileData, _OutputFile + "_packed");
+  WriteFileSegmentCompressed(Package, std::filesystem::file_size(_OutputFile), _OutputFile + "_packed");
 
   return true;
 }
 
+void SegmentedFile::SetThreadCount(
+    uint32_t _Count
+  )
+{
+  m_ThreadCount = _Count;
+}
+
+void SegmentedFile::SetDeterministic(
+    bool _Deterministic
+  )
+{
+  m_Deterministic = _Deterministic;
+}
+
+uint32_t SegmentedFile::EncodeSegment(
+    const unsigned char * _Data,
+    uint32_t              _Size,
+    unsigned char *       _Output
+  )
+{
+  int32_t CompressedSize = utility::ZlibCompress(_Data, _Size, _Output + sizeof(int32_t), ENCODED_SEGMENT_MAX_SIZE - sizeof(int32_t));
+
+  // Segments that do not shrink are stored, zero padded to a full segment
+  if (CompressedSize < 0 || CompressedSize >= static_cast<int32_t>(utility::COMPRESSED_CHUNK_MAX_SIZE))
+  {
+    CompressedSize = utility::COMPRESSED_CHUNK_MAX_SIZE;
+
+    std::memcpy(_Output + sizeof(int32_t), _Data, _Size);
+    std::fill(_Output + sizeof(int32_t) + _Size, _Output + sizeof(int32_t) + CompressedSize, 0);
+  }
+
+  std::memcpy(_Output, &CompressedSize, sizeof(CompressedSize));
+
+  return sizeof(int32_t) + CompressedSize;
+}
+
 //
 // Service
 //
@@ -300,7 +371,7 @@ std::vector<unsigned char> SegmentedFile::ReadSegmentCompressedFile(
     const std::string & _FileName
   ) const
 {
-  const int32_t FileSize = std::filesystem::file_size(_FileName);
+  const uint64_t FileSize = std::filesystem::file_size(_FileName);
   std::ifstream FileStream(_FileName, std::ios::binary);
   /*
   std::vector<unsigned char> Data_;
@@ -323,40 +394,60 @@ std::vector<unsigned char> SegmentedFile::ReadSegmentCompressedFile(
   FileStream.read(reinterpret_cast<char*>(&Header), sizeof(Header));
 
   std::vector<unsigned char> Data;
+  std::vector<uint8_t>       InputBuffer(utility::COMPRESSED_CHUNK_MAX_SIZE);
 
-  for (uint32_t ReadCount = 0; ReadCount < FileSize; )
+  for (uint64_t ReadCount = 0; ReadCount + utility::COMPRESSED_HEADER_SIZE < FileSize; )
   {
+    const uint64_t Left = FileSize - utility::COMPRESSED_HEADER_SIZE - ReadCount;
+
     uint32_t CompressedChunkSize = 0;
     FileStream.read(reinterpret_cast<char *>(&CompressedChunkSize), sizeof(CompressedChunkSize));
 
-    std::vector<uint8_t> OutBuffer(66000);
+    // A broken segment ends the package, what follows it would be misplaced
+    if (!FileStream || Left < sizeof(CompressedChunkSize) ||
+        CompressedChunkSize > utility::COMPRESSED_CHUNK_MAX_SIZE || CompressedChunkSize > Left - sizeof(CompressedChunkSize))
+    {
+      break;
+    }
+
+    // Inflate straight into the tail of the output instead of a per-segment buffer
+    const size_t DataSize = Data.size();
+    Data.resize(DataSize + utility::COMPRESSED_CHUNK_MAX_SIZE);
+
+    int32_t UncompressedSize = utility::COMPRESSED_CHUNK_MAX_SIZE;
 
     if (CompressedChunkSize == utility::COMPRESSED_CHUNK_MAX_SIZE)
     {
-      FileStream.read(reinterpret_cast<char*>(OutBuffer.data()), CompressedChunkSize);
-      std::copy(OutBuffer.begin(), OutBuffer.begin() + CompressedChunkSize, std::back_inserter(Data));
+      FileStream.read(reinterpret_cast<char*>(Data.data() + DataSize), CompressedChunkSize);
     }
     else
     {
-      std::vector<uint8_t> InputBuffer(CompressedChunkSize);
+      InputBuffer.resize(CompressedChunkSize);
       FileStream.read(reinterpret_cast<char*>(InputBuffer.data()), CompressedChunkSize);
 
-      const int32_t UncompressedSize = utility::ZlibDecompress(InputBuffer.data(), InputBuffer.size(), OutBuffer.data(), utility::COMPRESSED_CHUNK_MAX_SIZE);
-
-      if (UncompressedSize > 0)
-        std::copy(OutBuffer.begin(), OutBuffer.begin() + UncompressedSize, std::back_inserter(Data));
+      UncompressedSize = utility::ZlibDecompress(InputBuffer.data(), InputBuffer.size(), Data.data() + DataSize, utility::COMPRESSED_CHUNK_MAX_SIZE);
     }
 
     ReadCount += sizeof(int32_t) + CompressedChunkSize;
-    FileStream.seekg(ReadCount + utility::COMPRESSED_HEADER_SIZE, std::ios::beg);
+
+    // Only the last segment may inflate short
+    if (!FileStream || UncompressedSize <= 0 ||
+        (UncompressedSize < static_cast<int32_t>(utility::COMPRESSED_CHUNK_MAX_SIZE) && ReadCount + utility::COMPRESSED_HEADER_SIZE < FileSize))
+    {
+      Data.resize(DataSize);
+      break;
+    }
+
+    Data.resize(DataSize + UncompressedSize);
   }
 
   return Data;
 }
 
 void SegmentedFile::WriteFileSegmentCompressed(
-    std::vector<unsigned char> & _Data,
-    const std::string &          _FileName
+    std::istream &      _Input,
+    uint64_t            _Size,
+    const std::string & _FileName
   )
 {
   std::ofstream FileStream(_FileName, std::ios::binary);
@@ -368,35 +459,85 @@ void SegmentedFile::WriteFileSegmentCompressed(
     uint32_t FileSizeHighPart;
   } Header;
 
-  Header.Version           = 0xF0000004; // Always that value
-  Header.FileSizeHighPart  = (uint32_t)(_Data.size() * 1.25);
-  Header.FileSizeHighPart  = 0;
+  Header.Version                      = 0xF0000004; // Always that value
+  Header.FileSizeUncompressedProbably = static_cast<uint32_t>(_Size);
+  Header.FileSizeHighPart             = static_cast<uint32_t>(_Size >> 32);
 
   FileStream.write((const char *)&Header, sizeof(struct Header));
 
-  int i;
+  // Segments are always cut every COMPRESSED_CHUNK_MAX_SIZE bytes and deflated
+  // independently, so a batch can be spread over one pool of threads for the
+  // whole file while this thread reads and writes the batches in order
+  const uint32_t ThreadCount  = m_ThreadCount != 0 ? m_ThreadCount : std::max(1u, std::thread::hardware_concurrency());
+  const size_t   BatchSize    = ThreadCount * utility::SEGMENTS_PER_THREAD_BATCH;
+  const uint64_t SegmentCount = (_Size + utility::COMPRESSED_CHUNK_MAX_SIZE - 1) / utility::COMPRESSED_CHUNK_MAX_SIZE;
 
-  std::vector<unsigned char> Buffer(utility::COMPRESSED_CHUNK_MAX_SIZE * 2);
+  std::vector<unsigned char> Segments(std::min<uint64_t>(BatchSize, SegmentCount) * utility::COMPRESSED_CHUNK_MAX_SIZE);
+  std::vector<unsigned char> Buffers(std::min<uint64_t>(BatchSize, SegmentCount) * ENCODED_SEGMENT_MAX_SIZE);
+  std::vector<uint32_t>      EncodedSizes(BatchSize);
 
-  for (i = 0; i < _Data.size(); i += utility::COMPRESSED_CHUNK_MAX_SIZE)
+  // Current batch, published to the workers through the job queue
+  size_t   Count     = 0;
+  uint64_t BatchData = 0;
+
+  const auto SegmentSize = [&](size_t _Index)
   {
-    int size = (i + utility::COMPRESSED_CHUNK_MAX_SIZE >= _Data.size()) ? _Data.size() - i : utility::COMPRESSED_CHUNK_MAX_SIZE;
+    return static_cast<uint32_t>(std::min<uint64_t>(BatchData - _Index * utility::COMPRESSED_CHUNK_MAX_SIZE, utility::COMPRESSED_CHUNK_MAX_SIZE));
+  };
 
-    int32_t CompressedSize = utility::ZlibCompress(_Data.data() + i, size, Buffer.data(), Buffer.size());
+  WorkQueue<size_t>       Jobs;
+  std::mutex              DoneMutex;
+  std::condition_variable DoneCondition;
+  size_t                  Done = 0;
 
-    if (CompressedSize >= utility::COMPRESSED_CHUNK_MAX_SIZE)
+  std::vector<std::thread> Workers;
+
+  for (uint64_t i = 0; i < std::min<uint64_t>(ThreadCount, SegmentCount); ++i)
+  {
+    Workers.emplace_back([&]
     {
-      CompressedSize = utility::COMPRESSED_CHUNK_MAX_SIZE;
+      for (size_t Index; Jobs.Pop(Index); )
+      {
+        EncodedSizes[Index] = EncodeSegment(Segments.data() + Index * utility::COMPRESSED_CHUNK_MAX_SIZE, SegmentSize(Index), Buffers.data() + Index * ENCODED_SEGMENT_MAX_SIZE);
+
+        {
+          std::lock_guard Lock(DoneMutex);
+          ++Done;
+        }
+
+        DoneCondition.notify_one();
+      }
+    });
+  }
 
-      FileStream.write((const char *)&CompressedSize, sizeof(int32_t));
-      FileStream.write((const char*)(_Data.data() + size), utility::COMPRESSED_CHUNK_MAX_SIZE);
+  for (uint64_t First = 0; First < SegmentCount; First += BatchSize)
+  {
+    Count     = static_cast<size_t>(std::min<uint64_t>(BatchSize, SegmentCount - First));
+    BatchData = std::min<uint64_t>(_Size - First * utility::COMPRESSED_CHUNK_MAX_SIZE, Count * utility::COMPRESSED_CHUNK_MAX_SIZE);
+
+    _Input.read((char *)Segments.data(), BatchData);
+
+    {
+      std::lock_guard Lock(DoneMutex);
+      Done = 0;
     }
-    else
+
+    for (size_t Index = 0; Index < Count; ++Index)
+      Jobs.Push(Index);
+
     {
-      FileStream.write((const char *)&CompressedSize, sizeof(int32_t));
-      FileStream.write((const char *)Buffer.data(), CompressedSize);
+      std::unique_lock Lock(DoneMutex);
+      DoneCondition.wait(Lock, [&] { return Done == Count; });
     }
+
+    for (size_t Index = 0; Index < Count; ++Index)
+      FileStream.write((const char *)Buffers.data() + Index * ENCODED_SEGMENT_MAX_SIZE, EncodedSizes[Index]);
   }
+
+  Jobs.Close();
+
+  for (auto & Worker : Workers)
+    Worker.join();
 }
 
 int32_t SegmentedFile::UnpackBitsquidPackage(
@@ -404,27 +545,38 @@ int32_t SegmentedFile::UnpackBitsquidPackage(
     const std::string                & _OutPath
   )
 {
-  int32_t Offset = 0;
+  uint64_t Offset = 0;
   auto ReadBytes = [&](auto * _Destination) mutable
   {
     const size_t Size = sizeof(std::decay_t<decltype(*_Destination)>);
+
+    if (_Data.size() - Offset < Size)
+      return false;
+
     std::memcpy(_Destination, _Data.data() + Offset, Size);
     Offset += Size;
     
-    return Offset;
+    return true;
   };
 
-  int32_t RecordsCount = 0;
-  ReadBytes(&RecordsCount);
-
-  Offset += 256;
-
   struct Record
   {
     uint64_t TypeHash;
     uint64_t NameHash;
   };
 
+  // Counts and sizes come from the file, they are checked against what is
+  // left of the package before anything is allocated or written
+  int32_t RecordsCount = 0;
+
+  if (!ReadBytes(&RecordsCount) || RecordsCount < 0 || _Data.size() - Offset < utility::BITSQUID_PACKAGE_HEADER_SIZE)
+    return -1;
+
+  Offset += utility::BITSQUID_PACKAGE_HEADER_SIZE;
+
+  if (static_cast<uint64_t>(RecordsCount) > (_Data.size() - Offset) / sizeof(Record))
+    return -1;
+
   std::vector<Record> Records;
   Records.reserve(RecordsCount);
 
@@ -444,38 +596,48 @@ int32_t SegmentedFile::UnpackBitsquidPackage(
       uint64_t NameHash;
     } ResourceInfo;
 
-    ReadBytes(&ResourceInfo);
-
     struct ResourceData
     {
-      int32_t _;
-      int32_t FileSize;
-      int32_t FileSizeLower;
+      int32_t  _;
+      uint32_t FileSize;
+      uint32_t StreamSize;
     };
     
     int64_t ChunkCount = 0;
-    ReadBytes(&ChunkCount);
+
+    if (!ReadBytes(&ResourceInfo) || !ReadBytes(&ChunkCount) || ChunkCount < 0 ||
+        static_cast<uint64_t>(ChunkCount) > (_Data.size() - Offset) / sizeof(ResourceData))
+    {
+      return -1;
+    }
 
     std::vector<ResourceData> ChunksInfo(ChunkCount);
+    uint64_t                  ResourceSize = 0;
     
-    for (int32_t i = 0; i < ChunkCount; ++i)
+    for (int64_t i = 0; i < ChunkCount; ++i)
     {
       ResourceData Chunk;
       ReadBytes(&Chunk);
 
       ChunksInfo[i] = Chunk;
+      ResourceSize += Chunk.FileSize;
+
+      if (ResourceSize > _Data.size() - Offset)
+        return -1;
     }
 
+    // Chunks of a split resource follow each other, join them back into one file
+    const std::string OutputFileName = _OutPath + "/" + std::to_string(Records[i].NameHash) + GetFileTypeByHash(Records[i].TypeHash);
+
+    std::ofstream OutStream(OutputFileName, std::ios::binary);
+
     for (const auto & Chunk : ChunksInfo)
     {
-      assert(Chunk.FileSize > 0);
+      const uint64_t ChunkSize = Chunk.FileSize;
 
-      const std::string OutputFileName = _OutPath + "\\" + std::to_string(Records[i].NameHash) + GetFileTypeByHash(Records[i].TypeHash);
-      
-      std::ofstream OutStream(OutputFileName, std::ios::binary);
-      OutStream.write(reinterpret_cast<const char*>(_Data.data() + Offset), Chunk.FileSize);
+      OutStream.write(reinterpret_cast<const char*>(_Data.data() + Offset), ChunkSize);
 
-      Offset += Chunk.FileSize;
+      Offset += ChunkSize;
     }
   }
 
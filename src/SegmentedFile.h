@@ -2,9 +2,16 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <istream>
+#include <cstdint>
 
 class SegmentedFile
 {
+public: // Constants
+
+  // Size field plus zlib's worst case for one segment
+  static constexpr size_t ENCODED_SEGMENT_MAX_SIZE = sizeof(int32_t) + 2 * 65536;
+
 public: // Interface
 
   bool Decompress(
@@ -17,6 +24,26 @@ public: // Interface
       const std::string & _OutputFile
     );
 
+  // Deflate threads of Compress, hardware concurrency when zero.
+  // Output never depends on it
+  void SetThreadCount(
+      uint32_t _Count
+    );
+
+  // Refuse inputs whose bundle would depend on directory iteration order,
+  // e.g. two files mapping to the same type and name hash
+  void SetDeterministic(
+      bool _Deterministic
+    );
+
+  // One segment exactly as Compress writes it, size field first, into at
+  // least ENCODED_SEGMENT_MAX_SIZE bytes. Returns the bytes written.
+  static uint32_t EncodeSegment(
+      const unsigned char * _Data,
+      uint32_t              _Size,
+      unsigned char *       _Output
+    );
+
 protected: // Service
 
   std::vector<unsigned char> ReadSegmentCompressedFile(
@@ -24,8 +51,9 @@ protected: // Service
     ) const;
 
   void WriteFileSegmentCompressed(
-      std::vector<unsigned char> & _Data,
-      const std::string &          _FileName
+      std::istream &      _Input,
+      uint64_t            _Size,
+      const std::string & _FileName
     );
 
   int32_t UnpackBitsquidPackage(
@@ -40,4 +68,6 @@ protected: // Service
 protected: // Members
   
   std::map<uint64_t, std::string> m_TypeHashes;
+  uint32_t                        m_ThreadCount = 0;
+  bool                            m_Deterministic = false;
 };
\ No newline at end of file
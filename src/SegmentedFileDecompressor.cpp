@@ -6,61 +6,85 @@
 #include <cassert>
 #include <map>
 #include <array>
+#include <algorithm>
+#include <cstring>
+#include <charconv>
+#include <thread>
+#include <atomic>
+#include <type_traits>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "MurmurHash2/MurmurHash2.h"
+#include "BitsquidResourceTypes.h"
+#include "MappedFile.h"
+#include "PackageParser.h"
+#include "Pipeline.h"
+#include "BundleIndex.h"
+#include "AllocationCounter.h"
 
 namespace utility
 {
   constexpr size_t COMPRESSED_HEADER_SIZE = 12;
   constexpr size_t COMPRESSED_CHUNK_MAX_SIZE = 65536;
   constexpr size_t BITSQUID_PACKAGE_HEADER_SIZE = 256;
+  constexpr size_t FOLDERS_PER_THREAD = 32;
 
-  static constexpr std::array BitsquidResourceNames
+  // Two hex digits of the top byte, 256 shards keep a full game in a few thousand entries per folder
+  static void AppendShard(std::string & _Path, uint64_t _NameHash)
   {
-      std::pair{"config", ".txt" },
-      std::pair{"render_config", ".txt" },
-      std::pair{"unit", ".dat"},
-      std::pair{"shader_library_group", ".txt"},
-      std::pair{"shader_library", ".txt"},
-      std::pair{"shader", ".txt"},
-      std::pair{"texture", ".txt"},
-      std::pair{"material", ".txt"},
-      std::pair{"animation", ".txt"},
-      std::pair{"animation_curves", ".txt"},
-      std::pair{"bones", ".txt"},
-      std::pair{"state_machine", ".txt"},
-      std::pair{"physics_properties", ".txt"},
-      std::pair{"package", ".txt"},
-      std::pair{"particles", ".txt"},
-      std::pair{"sound_environment", ".txt"},
-      std::pair{"font", ".ttf"},
-      std::pair{"vaw", ".txt"},
-      std::pair{"aul", ".txt"},
-      std::pair{"level", ".txt"},
-      std::pair{"data", ".txt"},
-      std::pair{"shading_environment", ".txt"},
-      std::pair{"strings", ".txt"},
-      std::pair{"network_config", ".txt"},
-      std::pair{"mouse_cursor", ".txt"},
-      std::pair{"timpani_bank", ".txt"},
-      std::pair{"flow", ".txt"},
-      std::pair{"surface_properties", ".txt"},
-      std::pair{"baked_lighting", ".txt"},
-      std::pair{"mp4", ".txt"},
-      std::pair{"ivf", ".txt"},
-      std::pair{"bik", ".txt"},
-      std::pair{"vector_field", ".txt"},
-      std::pair{"cane", ".txt"},
-      std::pair{"cane_tilecache", ".txt"},
-      std::pair{"entity", ".txt"},
-      std::pair{"scene", ".txt"},
-      std::pair{"bpa", ".txt"},
-      std::pair{"lua", ".lua"},
-      std::pair{"script", ".lua"},
-      std::pair{"scripts", ".lua"}
-  };
+    constexpr char Digits[] = "0123456789abcdef";
+
+    _Path.push_back(Digits[_NameHash >> 60]);
+    _Path.push_back(Digits[(_NameHash >> 56) & 0xF]);
+  }
+
+  // One write per resource, a stream would allocate its buffer on every open.
+  // An existing file is unlinked, never rewritten, it may be a hardlink
+  // shared with other outputs or mapped by a dedup comparison.
+  static bool WriteFile(const std::string & _FileName, const unsigned char * _Data, uint64_t _Size)
+  {
+#ifdef __linux__
+
+    unlink(_FileName.c_str());
+
+    const int File = open(_FileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (File < 0)
+      return false;
+
+    while (_Size != 0)
+    {
+      const ssize_t Written = write(File, _Data, _Size);
+
+      if (Written <= 0)
+        break;
 
-  int32_t ZlibDecompress(uint8_t * in_buf, uint32_t in_size, uint8_t * out_buf, uint32_t out_size)
+      _Data += Written;
+      _Size -= Written;
+    }
+
+    return close(File) == 0 && _Size == 0;
+
+#else
+
+    std::error_code Error;
+    std::filesystem::remove(_FileName, Error);
+
+    std::ofstream OutStream(_FileName, std::ios::binary);
+    OutStream.write(reinterpret_cast<const char *>(_Data), _Size);
+
+    return OutStream.good();
+
+#endif
+  }
+
+  static int32_t ZlibDecompress(uint8_t * in_buf, uint32_t in_size, uint8_t * out_buf, uint32_t out_size)
   {
     /* some common variables. */
     int32_t result = 0;
@@ -89,8 +113,9 @@ namespace utility
     if ((result = inflate(&z, Z_FINISH)) != Z_STREAM_END)
     {
 
-      /* something on zlib decompression failed. */
-      return result;
+      /* something on zlib decompression failed, a truncated stream is an error too. */
+      inflateEnd(&z);
+      return result < 0 ? result : Z_DATA_ERROR;
     }
 
     /* save transferred bytes. */
@@ -126,106 +151,203 @@ bool SegmentedFileDecompressor::Decompress(
 
   m_Folder = _Folder;
 
-  uint64_t FileCount = 0;
+  if (!PrepareOutputFolders(_OutFolder))
+  {
+    std::cerr << "Cannot create output folders in " << _OutFolder << std::endl;
+    return false;
+  }
 
-  for (const auto & _ : std::filesystem::directory_iterator(_Folder))
-    FileCount++;
+  if (m_DedupMode == DedupMode::Manifest)
+    m_Manifest.open(_OutFolder + "/dedup_manifest.txt", std::ios::trunc);
+
+  if (!m_Filter.IsEmpty())
+    return DecompressFiltered(_Folder, _OutFolder) && WriteManifest();
+
+  std::vector<std::string> Files;
 
-  uint64_t FileProcessed = 0;
   for (const auto & File : std::filesystem::directory_iterator(_Folder))
   {
     if (!File.is_directory())
-      UnpackBitsquidPackage(ReadSegmentCompressedFile(File.path().string()), _OutFolder);
+      Files.push_back(File.path().string());
+  }
+
+  if (m_MemoryLimit != 0)
+    return DecompressPipelined(Files, _OutFolder) && WriteManifest();
 
-    std::cout << (float)(++FileProcessed) / FileCount * 100 << "% completed" << std::endl;
+  uint64_t FileProcessed = 0;
+  for (const auto & File : Files)
+  {
+    const uint64_t Allocations = AllocationCounter::GetCount();
+
+    if (UnpackBitsquidPackage(ReadSegmentCompressedFile(File), _OutFolder) < 0)
+      std::cerr << "Malformed or truncated bundle " << File << std::endl;
+
+    m_Statistics.BundlesProcessed++;
+    m_Statistics.HeapAllocations += AllocationCounter::GetCount() - Allocations;
+
+    std::cout << (float)(++FileProcessed) / Files.size() * 100 << "% completed" << std::endl;
   }
 
-  return true;
+  return WriteManifest();
+}
+
+void SegmentedFileDecompressor::SetMemoryLimit(
+    uint64_t _Bytes
+  )
+{
+  // Below that a half-budget resource plus one segment in flight wouldn't fit
+  m_MemoryLimit = _Bytes == 0 ? 0 : std::max<uint64_t>(_Bytes, 1024 * 1024);
+}
+
+void SegmentedFileDecompressor::SetThreadCount(
+    uint32_t _Count
+  )
+{
+  m_ThreadCount = _Count;
+}
+
+void SegmentedFileDecompressor::SetDedupMode(
+    DedupMode _Mode
+  )
+{
+  m_DedupMode = _Mode;
+}
+
+void SegmentedFileDecompressor::SetOutputLayout(
+    OutputLayout _Layout
+  )
+{
+  m_Layout = _Layout;
+}
+
+void SegmentedFileDecompressor::SetReadahead(
+    uint32_t _Segments
+  )
+{
+  m_Readahead.SetSegments(_Segments);
+}
+
+void SegmentedFileDecompressor::SetFilter(
+    const ResourceFilter & _Filter
+  )
+{
+  m_Filter = _Filter;
+}
+
+void SegmentedFileDecompressor::SetHeaderCache(
+    const std::string & _FileName
+  )
+{
+  m_HeaderCacheFile = _FileName;
+}
+
+const SegmentedFileDecompressor::Statistics & SegmentedFileDecompressor::GetStatistics() const
+{
+  return m_Statistics;
 }
 
 //
 // Service
 //
 
-std::vector<unsigned char> SegmentedFileDecompressor::ReadSegmentCompressedFile(
+const SegmentedFileDecompressor::PackageBuffer & SegmentedFileDecompressor::ReadSegmentCompressedFile(
     const std::string & _FileName
-  ) const
+  )
 {
-  const int32_t              FileSize = std::filesystem::file_size(_FileName);
-  std::ifstream              FileStream(_FileName, std::ios::binary);
-  
-  assert(FileStream.is_open() && "[Unexpected]: Cannot open stream");
+  PackageBuffer & Data = m_Buffers.Package;
+  Data.clear();
 
-  // Skip header
-  struct Header
-  {
-    int32_t Version;
-    int32_t Magic1;
-    int32_t Magic2;
-  } Header;
+  // Segments are inflated straight from the mapping while the readahead
+  // thread keeps the next ones coming in
+  MappedFile File;
 
-  FileStream.read(reinterpret_cast<char*>(&Header), sizeof(Header));
+  if (!File.Open(_FileName))
+    return Data;
 
-  std::vector<unsigned char> Data;
+  m_Readahead.Attach(File);
 
-  for (uint32_t ReadCount = 0; ReadCount < FileSize; )
+  const unsigned char * Input    = File.GetData();
+  const uint64_t        FileSize = File.GetSize();
+
+  for (uint64_t Offset = utility::COMPRESSED_HEADER_SIZE; Offset < FileSize; )
   {
+    m_Readahead.Advance(Offset);
+
     uint32_t CompressedChunkSize = 0;
-    FileStream.read(reinterpret_cast<char *>(&CompressedChunkSize), sizeof(CompressedChunkSize));
 
-    std::vector<uint8_t> OutBuffer(66000);
+    // A broken segment ends the package, what follows it would be misplaced
+    if (FileSize - Offset < sizeof(CompressedChunkSize))
+      break;
+
+    std::memcpy(&CompressedChunkSize, Input + Offset, sizeof(CompressedChunkSize));
+    Offset += sizeof(CompressedChunkSize);
+
+    if (CompressedChunkSize > utility::COMPRESSED_CHUNK_MAX_SIZE || CompressedChunkSize > FileSize - Offset)
+      break;
+
+    // Inflate straight into the tail of the package buffer
+    const size_t DataSize = Data.size();
+    ReserveBuffer(Data, DataSize + utility::COMPRESSED_CHUNK_MAX_SIZE);
+    Data.resize(DataSize + utility::COMPRESSED_CHUNK_MAX_SIZE);
+
+    int32_t UncompressedSize = utility::COMPRESSED_CHUNK_MAX_SIZE;
 
     if (CompressedChunkSize == utility::COMPRESSED_CHUNK_MAX_SIZE)
-    {
-      FileStream.read(reinterpret_cast<char*>(OutBuffer.data()), CompressedChunkSize);
-      std::copy(OutBuffer.begin(), OutBuffer.begin() + CompressedChunkSize, std::back_inserter(Data));
-    }
+      std::memcpy(Data.data() + DataSize, Input + Offset, CompressedChunkSize);
     else
-    {
-      std::vector<uint8_t> InputBuffer(CompressedChunkSize);
-      FileStream.read(reinterpret_cast<char*>(InputBuffer.data()), CompressedChunkSize);
+      UncompressedSize = utility::ZlibDecompress(const_cast<uint8_t *>(Input + Offset), CompressedChunkSize, Data.data() + DataSize, utility::COMPRESSED_CHUNK_MAX_SIZE);
 
-      const int32_t UncompressedSize = utility::ZlibDecompress(InputBuffer.data(), InputBuffer.size(), OutBuffer.data(), utility::COMPRESSED_CHUNK_MAX_SIZE);
+    Offset += CompressedChunkSize;
 
-      if (UncompressedSize > 0)
-        std::copy(OutBuffer.begin(), OutBuffer.begin() + UncompressedSize, std::back_inserter(Data));
+    // Only the last segment may inflate short
+    if (UncompressedSize <= 0 || (UncompressedSize < static_cast<int32_t>(utility::COMPRESSED_CHUNK_MAX_SIZE) && Offset < FileSize))
+    {
+      Data.resize(DataSize);
+      break;
     }
 
-    ReadCount += sizeof(int32_t) + CompressedChunkSize;
-    FileStream.seekg(ReadCount + utility::COMPRESSED_HEADER_SIZE, std::ios::beg);
+    Data.resize(DataSize + UncompressedSize);
   }
 
+  m_Readahead.Detach();
+
   return Data;
 }
 
 int32_t SegmentedFileDecompressor::UnpackBitsquidPackage(
-    const std::vector<unsigned char> & _Data,
-    const std::string                & _OutPath
+    const PackageBuffer & _Data,
+    const std::string &   _OutPath
   )
 {
-  int32_t Offset = 0;
+  uint64_t Offset = 0;
   auto ReadBytes = [&](auto * _Destination) mutable
   {
     const size_t Size = sizeof(std::decay_t<decltype(*_Destination)>);
+
+    if (_Data.size() - Offset < Size)
+      return false;
+
     std::memcpy(_Destination, _Data.data() + Offset, Size);
     Offset += Size;
     
-    return Offset;
+    return true;
   };
 
+  // Counts and sizes come from the file, they are checked against what is
+  // left of the package before anything is allocated or written
   int32_t RecordsCount = 0;
-  ReadBytes(&RecordsCount);
 
-  Offset += 256;
+  if (!ReadBytes(&RecordsCount) || RecordsCount < 0 || _Data.size() - Offset < utility::BITSQUID_PACKAGE_HEADER_SIZE)
+    return -1;
 
-  struct Record
-  {
-    uint64_t TypeHash;
-    uint64_t NameHash;
-  };
+  Offset += utility::BITSQUID_PACKAGE_HEADER_SIZE;
 
-  std::vector<Record> Records;
-  Records.reserve(RecordsCount);
+  if (static_cast<uint64_t>(RecordsCount) > (_Data.size() - Offset) / sizeof(Record))
+    return -1;
+
+  std::vector<Record> & Records = m_Buffers.Records;
+  Records.clear();
+  ReserveBuffer(Records, RecordsCount);
 
   for (int32_t i = 0; i < RecordsCount; ++i)
   {
@@ -243,23 +365,19 @@ int32_t SegmentedFileDecompressor::UnpackBitsquidPackage(
       uint64_t TypeHash;
     } ResourceInfo;
 
-    ReadBytes(&ResourceInfo);
+    int64_t ChunkCount = 0;
 
-    struct ResourceData
+    if (!ReadBytes(&ResourceInfo) || !ReadBytes(&ChunkCount) || ChunkCount < 0 ||
+        static_cast<uint64_t>(ChunkCount) > (_Data.size() - Offset) / sizeof(ResourceData))
     {
-      int32_t _;
-      int32_t FileSize;
-      int32_t StreamSize;
-    };
-
-    int32_t ChunkCount = 0;
-    ReadBytes(&ChunkCount);
-
-    Offset += sizeof(int32_t); // Skip unused
+      return -1;
+    }
 
-    std::vector<ResourceData> ChunksInfo(ChunkCount);
+    std::vector<ResourceData> & ChunksInfo = m_Buffers.Chunks;
+    ChunksInfo.clear();
+    ReserveBuffer(ChunksInfo, ChunkCount);
     
-    for (int32_t i = 0; i < ChunkCount; ++i)
+    for (int64_t i = 0; i < ChunkCount; ++i)
     {
       ResourceData Chunk;
       ReadBytes(&Chunk);
@@ -267,21 +385,573 @@ int32_t SegmentedFileDecompressor::UnpackBitsquidPackage(
       ChunksInfo.push_back(Chunk);
     }
 
+    // Chunks of a split resource follow each other, join them back into one file
+    uint64_t ResourceSize = 0;
+
     for (const auto & Chunk : ChunksInfo)
     {
-      const std::string OutputFileName = _OutPath + "\\" + std::to_string(Records[i].NameHash) + "." + GetFileTypeByHash(Records[i].TypeHash);
-      
-      std::ofstream OutStream(OutputFileName, std::ios::binary);
-      OutStream.write(reinterpret_cast<const char*>(_Data.data() + Offset), Chunk.FileSize);
+      ResourceSize += Chunk.FileSize;
 
-      Offset += Chunk.FileSize;
+      if (ResourceSize > _Data.size() - Offset)
+        return -1;
     }
+
+    std::string & OutputFileName = m_Buffers.FileName;
+    BuildOutputFileName(OutputFileName, _OutPath, Records[i].TypeHash, Records[i].NameHash);
+
+    if (!WriteResource(OutputFileName, _Data.data() + Offset, ResourceSize))
+      m_Statistics.WriteFailures++;
+
+    Offset += ResourceSize;
   }
 
   return RecordsCount;
 }
 
-std::string SegmentedFileDecompressor::GetFileTypeByHash(
+bool SegmentedFileDecompressor::DecompressPipelined(
+    const std::vector<std::string> & _Files,
+    const std::string &              _OutFolder
+  )
+{
+  const uint32_t InflateThreads = m_ThreadCount != 0 ? m_ThreadCount : std::max(1u, std::thread::hardware_concurrency());
+  const uint32_t WriteThreads   = std::max(2u, InflateThreads / 2);
+
+  // Larger resources go to disk piece by piece instead of being assembled,
+  // which keeps the parser from waiting on memory only it could free
+  const uint64_t StreamThreshold = m_MemoryLimit / 2;
+
+  // Spare pooled capacity isn't charged to the budget, keep it to a small share
+  ByteBudget Budget(m_MemoryLimit);
+  BufferPool Buffers(m_MemoryLimit / 8);
+
+  struct Segment
+  {
+    uint64_t                   Sequence;
+    uint32_t                   Bundle;
+    bool                       Stored;
+    uint64_t                   Reserved; // Budget held on behalf of this segment
+    std::vector<unsigned char> Data;
+    bool                       Last   = false; // Of its bundle, the only one allowed to inflate short
+    bool                       Broken = false; // Truncated or failed to inflate, Data is empty
+  };
+
+  struct Write
+  {
+    std::string                FileName;
+    std::vector<unsigned char> Data;
+    bool                       Whole;
+    bool                       First;
+    bool                       Last;
+    bool                       Abandoned = false; // The streamed resource never completes, drop it
+  };
+
+  WorkQueue<Segment>            InflateQueue;
+  std::vector<WorkQueue<Write>> WriteQueues(WriteThreads);
+
+  // Inflated segments wait here until the parser gets to them, in order
+  std::mutex                   Mutex;
+  std::condition_variable      Condition;
+  std::map<uint64_t, Segment>  Inflated;
+  uint64_t                     SegmentCount = UINT64_MAX;
+
+  std::thread Reader([&]
+  {
+    uint64_t Sequence = 0;
+
+    for (uint32_t Bundle = 0; Bundle < _Files.size(); ++Bundle)
+    {
+      std::error_code Error;
+      const uint64_t  FileSize = std::filesystem::file_size(_Files[Bundle], Error);
+
+      if (Error)
+      {
+        std::cerr << "Cannot read bundle " << _Files[Bundle] << ": " << Error.message() << std::endl;
+        continue;
+      }
+
+      std::ifstream FileStream(_Files[Bundle], std::ios::binary);
+
+      FileStream.seekg(utility::COMPRESSED_HEADER_SIZE, std::ios::beg);
+
+      for (uint64_t ReadCount = 0; ReadCount + utility::COMPRESSED_HEADER_SIZE < FileSize; )
+      {
+        uint32_t CompressedChunkSize = 0;
+        FileStream.read(reinterpret_cast<char *>(&CompressedChunkSize), sizeof(CompressedChunkSize));
+
+        const bool Malformed = !FileStream || CompressedChunkSize > utility::COMPRESSED_CHUNK_MAX_SIZE;
+
+        // Room for the compressed bytes and for what they inflate to
+        Segment Item{ Sequence++, Bundle, CompressedChunkSize == utility::COMPRESSED_CHUNK_MAX_SIZE, Malformed ? 0 : CompressedChunkSize + utility::COMPRESSED_CHUNK_MAX_SIZE, Buffers.Get() };
+        Budget.Acquire(Item.Reserved);
+
+        if (!Malformed)
+        {
+          Item.Data.resize(CompressedChunkSize);
+          FileStream.read(reinterpret_cast<char *>(Item.Data.data()), CompressedChunkSize);
+        }
+
+        ReadCount += sizeof(int32_t) + CompressedChunkSize;
+
+        // A broken segment goes on empty to keep the sequence whole, the
+        // parser then drops the rest of the bundle and reports it
+        Item.Last   = ReadCount + utility::COMPRESSED_HEADER_SIZE >= FileSize;
+        Item.Broken = Malformed || !FileStream;
+
+        if (Item.Broken)
+          Item.Data.clear();
+
+        const bool Broken = Item.Broken;
+
+        InflateQueue.Push(std::move(Item));
+
+        if (Broken)
+          break;
+      }
+    }
+
+    {
+      std::lock_guard Lock(Mutex);
+      SegmentCount = Sequence;
+    }
+
+    Condition.notify_all();
+    InflateQueue.Close();
+  });
+
+  std::vector<std::thread> Inflaters;
+
+  for (uint32_t i = 0; i < InflateThreads; ++i)
+  {
+    Inflaters.emplace_back([&]
+    {
+      Segment Item;
+
+      while (InflateQueue.Pop(Item))
+      {
+        if (!Item.Stored && !Item.Broken)
+        {
+          std::vector<unsigned char> Data = Buffers.Get();
+          Data.resize(utility::COMPRESSED_CHUNK_MAX_SIZE);
+
+          const int32_t UncompressedSize = utility::ZlibDecompress(Item.Data.data(), static_cast<uint32_t>(Item.Data.size()), Data.data(), utility::COMPRESSED_CHUNK_MAX_SIZE);
+
+          // Only the last segment of a bundle may inflate short
+          Item.Broken = UncompressedSize <= 0 || (UncompressedSize < static_cast<int32_t>(utility::COMPRESSED_CHUNK_MAX_SIZE) && !Item.Last);
+          Data.resize(Item.Broken ? 0 : UncompressedSize);
+
+          std::swap(Item.Data, Data);
+          Buffers.Put(std::move(Data));
+        }
+
+        // From here on only the inflated bytes are held
+        Budget.Release(Item.Reserved - Item.Data.size());
+        Item.Reserved = Item.Data.size();
+
+        {
+          std::lock_guard Lock(Mutex);
+          Inflated.emplace(Item.Sequence, std::move(Item));
+        }
+
+        Condition.notify_all();
+      }
+    });
+  }
+
+  std::vector<std::thread> Writers;
+  std::atomic<uint64_t>    WriteFailures = 0;
+
+  for (auto & Queue : WriteQueues)
+  {
+    Writers.emplace_back([&, Queue = &Queue]
+    {
+      Write         Item;
+      std::ofstream Stream;
+      std::string   StreamName; // Removed again unless all its pieces get written
+
+      const auto Discard = [&]
+      {
+        Stream.close();
+        Stream.clear();
+
+        std::error_code Error;
+        std::filesystem::remove(StreamName, Error);
+      };
+
+      while (Queue->Pop(Item))
+      {
+        if (Item.Abandoned)
+        {
+          if (Stream.is_open())
+            Discard();
+        }
+        else if (Item.Whole)
+        {
+          if (!WriteResource(Item.FileName, Item.Data.data(), Item.Data.size()))
+            WriteFailures++;
+        }
+        else
+        {
+          if (Item.First)
+          {
+            // The previous resource never got its last piece
+            if (Stream.is_open())
+              Discard();
+
+            // Streamed resources skip dedup, but may replace an original
+            if (m_DedupMode != DedupMode::None)
+            {
+              std::lock_guard Lock(m_DedupMutex);
+              ReleasePath(Item.FileName);
+            }
+
+            StreamName = std::move(Item.FileName);
+
+            std::error_code Error;
+            std::filesystem::remove(StreamName, Error);
+
+            Stream.clear();
+            Stream.open(StreamName, std::ios::binary | std::ios::trunc);
+
+            if (!Stream.is_open())
+              WriteFailures++;
+          }
+
+          // The rest of a resource that failed is skipped until the next one opens
+          if (Stream.is_open())
+          {
+            Stream.write(reinterpret_cast<const char *>(Item.Data.data()), Item.Data.size());
+
+            if (Stream && Item.Last)
+              Stream.close();
+
+            if (!Stream)
+            {
+              WriteFailures++;
+              Discard();
+            }
+          }
+        }
+
+        Budget.Release(Item.Data.size());
+        Buffers.Put(std::move(Item.Data));
+      }
+    });
+  }
+
+  // Parse on this thread. Every resource is routed to one writer by its
+  // hashes, so pieces of a streamed resource and repeated paths stay ordered.
+  std::string                OutputFileName;
+  std::vector<unsigned char> Payload;
+  uint64_t                   PayloadLeft = 0;
+  uint32_t                   Route       = 0;
+  bool                       Streaming   = false;
+  bool                       First       = true;
+
+  PackageParser Parser(
+    [&](const PackageParser::Record & _Record, uint64_t _Size)
+    {
+      BuildOutputFileName(OutputFileName, _OutFolder, _Record.TypeHash, _Record.NameHash);
+
+      Route       = static_cast<uint32_t>((_Record.TypeHash ^ _Record.NameHash) % WriteThreads);
+      Streaming   = _Size > StreamThreshold;
+      PayloadLeft = _Size;
+      First       = true;
+
+      if (_Size == 0)
+        WriteQueues[Route].Push(Write{ OutputFileName, {}, true, true, true });
+      else if (!Streaming)
+        Payload = Buffers.Get();
+    },
+    [&](const unsigned char * _Data, uint64_t _Size)
+    {
+      // The segment these bytes come from is released once parsed
+      Budget.ForceAcquire(_Size);
+      PayloadLeft -= _Size;
+
+      if (Streaming)
+      {
+        // Only the first piece opens the file, the rest go without a copy of the name
+        Write Piece{ First ? OutputFileName : std::string(), Buffers.Get(), false, First, PayloadLeft == 0 };
+        Piece.Data.assign(_Data, _Data + _Size);
+
+        WriteQueues[Route].Push(std::move(Piece));
+        First = false;
+
+        return;
+      }
+
+      Payload.insert(Payload.end(), _Data, _Data + _Size);
+
+      if (PayloadLeft == 0)
+        WriteQueues[Route].Push(Write{ OutputFileName, std::move(Payload), true, true, true });
+    });
+
+  uint32_t Bundle  = UINT32_MAX;
+  bool     Healthy = true;
+
+  const auto FinishBundle = [&]
+  {
+    if (Bundle == UINT32_MAX)
+      return;
+
+    if (!Healthy || !Parser.IsComplete())
+      std::cerr << "Malformed or truncated bundle " << _Files[Bundle] << std::endl;
+
+    // Drop whatever a broken bundle left half assembled or half written
+    Budget.Release(Payload.size());
+    Payload.clear();
+
+    if (Streaming && PayloadLeft != 0)
+      WriteQueues[Route].Push(Write{ {}, {}, false, false, false, true });
+
+    Streaming   = false;
+    PayloadLeft = 0;
+
+    m_Statistics.BundlesProcessed++;
+
+    std::cout << (float)(Bundle + 1) / _Files.size() * 100 << "% completed" << std::endl;
+  };
+
+  for (uint64_t Next = 0; ; ++Next)
+  {
+    Segment Item;
+
+    {
+      std::unique_lock Lock(Mutex);
+      Condition.wait(Lock, [&] { return Inflated.count(Next) || Next >= SegmentCount; });
+
+      const auto it = Inflated.find(Next);
+
+      if (it == Inflated.end())
+        break;
+
+      Item = std::move(it->second);
+      Inflated.erase(it);
+    }
+
+    if (Item.Bundle != Bundle)
+    {
+      FinishBundle();
+
+      Bundle  = Item.Bundle;
+      Healthy = true;
+      Parser.Reset();
+    }
+
+    // Whatever follows a broken segment would be parsed at the wrong offset
+    if (Item.Broken)
+      Healthy = false;
+
+    if (Healthy)
+      Healthy = Parser.Feed(Item.Data.data(), Item.Data.size());
+
+    Budget.Release(Item.Reserved);
+    Buffers.Put(std::move(Item.Data));
+  }
+
+  FinishBundle();
+
+  Reader.join();
+
+  for (auto & Inflater : Inflaters)
+    Inflater.join();
+
+  for (auto & Queue : WriteQueues)
+    Queue.Close();
+
+  for (auto & Writer : Writers)
+    Writer.join();
+
+  m_Statistics.PeakBytesInFlight = Budget.GetPeak();
+  m_Statistics.WriteFailures    += WriteFailures;
+
+  return true;
+}
+
+bool SegmentedFileDecompressor::DecompressFiltered(
+    const std::string & _Folder,
+    const std::string & _OutFolder
+  )
+{
+  PackageBuffer & Payload = m_Buffers.Package;
+
+  // Only the record tables and the payloads that pass the filter are read,
+  // segments holding nothing else are never inflated. With a valid header
+  // cache even the record tables come without inflating anything. Bundles
+  // are opened one at a time, a folder may hold more than fit open at once.
+  // The record table is spread over the whole package, so the cache keeps
+  // every segment of the current bundle for the payload pass, at most its
+  // inflated size like the unfiltered unpack, and is emptied after it.
+  SegmentCache Cache(UINT64_MAX);
+
+  return m_Headers.VisitFolder(_Folder, m_HeaderCacheFile, &Cache, [&](BundleIndex & _Bundle, uint64_t _Index, uint64_t _Count)
+  {
+    // Every type this bundle writes is known from its record table, create their folders at once
+    if (m_Layout == OutputLayout::PerType)
+    {
+      std::vector<uint64_t>    Types;
+      std::vector<std::string> Folders;
+
+      for (const auto & Resource : _Bundle.GetResources())
+      {
+        if (m_Filter.Matches(Resource.TypeHash, Resource.NameHash) && !m_TypeFolders.count(Resource.TypeHash) &&
+            std::find(Types.begin(), Types.end(), Resource.TypeHash) == Types.end())
+        {
+          Types.push_back(Resource.TypeHash);
+          Folders.push_back(_OutFolder + "/" + GetFileTypeByHash(Resource.TypeHash));
+        }
+      }
+
+      // Only recorded once they exist, BuildOutputFileName retries and reports the others
+      if (CreateFolders(Folders))
+        m_TypeFolders.insert(Types.begin(), Types.end());
+    }
+
+    for (const auto & Resource : _Bundle.GetResources())
+    {
+      if (!m_Filter.Matches(Resource.TypeHash, Resource.NameHash))
+      {
+        m_Statistics.ResourcesSkipped++;
+        continue;
+      }
+
+      ReserveBuffer(Payload, Resource.Size);
+      Payload.resize(Resource.Size);
+
+      if (!_Bundle.Read(Resource.Offset, Payload.data(), Resource.Size))
+      {
+        std::cerr << "Cannot read resource " << Resource.NameHash << " from " << _Bundle.GetFileName() << std::endl;
+        continue;
+      }
+
+      BuildOutputFileName(m_Buffers.FileName, _OutFolder, Resource.TypeHash, Resource.NameHash);
+
+      if (!WriteResource(m_Buffers.FileName, Payload.data(), Payload.size()))
+        m_Statistics.WriteFailures++;
+    }
+
+    m_Statistics.BundlesProcessed++;
+    m_Statistics.SegmentsInflated += _Bundle.GetInflateCount();
+    m_Statistics.SegmentsTotal    += _Bundle.GetSegments().size();
+
+    Cache.Clear();
+
+    std::cout << (float)(_Index + 1) / _Count * 100 << "% completed" << std::endl;
+
+    return true;
+  });
+}
+
+bool SegmentedFileDecompressor::PrepareOutputFolders(
+    const std::string & _OutFolder
+  )
+{
+  m_TypeFolders.clear();
+
+  std::error_code Error;
+  std::filesystem::create_directories(_OutFolder, Error);
+
+  if (Error)
+    return false;
+
+  if (m_Layout != OutputLayout::Sharded)
+    return true;
+
+  std::vector<std::string> Folders(256, _OutFolder + "/");
+
+  for (uint64_t i = 0; i < Folders.size(); ++i)
+    utility::AppendShard(Folders[i], i << 56);
+
+  return CreateFolders(Folders);
+}
+
+bool SegmentedFileDecompressor::CreateFolders(
+    const std::vector<std::string> & _Folders
+  ) const
+{
+  // Every mkdir is a synchronous metadata update, a few threads overlap them
+  const size_t Threads = std::min<size_t>(
+    m_ThreadCount != 0 ? m_ThreadCount : std::max(1u, std::thread::hardware_concurrency()),
+    (_Folders.size() + utility::FOLDERS_PER_THREAD - 1) / utility::FOLDERS_PER_THREAD);
+
+  std::atomic<size_t> Next   = 0;
+  std::atomic<bool>   Failed = false;
+
+  const auto Create = [&]
+  {
+    for (size_t i = Next++; i < _Folders.size(); i = Next++)
+    {
+      std::error_code Error;
+      std::filesystem::create_directories(_Folders[i], Error);
+
+      if (Error)
+        Failed = true;
+    }
+  };
+
+  std::vector<std::thread> Workers;
+
+  for (size_t i = 1; i < Threads; ++i)
+    Workers.emplace_back(Create);
+
+  Create();
+
+  for (auto & Worker : Workers)
+    Worker.join();
+
+  return !Failed;
+}
+
+void SegmentedFileDecompressor::BuildOutputFileName(
+    std::string &       _FileName,
+    const std::string & _OutPath,
+    uint64_t            _TypeHash,
+    uint64_t            _NameHash
+  )
+{
+  char NameHash[24];
+  const auto NameHashEnd = std::to_chars(std::begin(NameHash), std::end(NameHash), _NameHash).ptr;
+
+  const std::string & Type = GetFileTypeByHash(_TypeHash);
+
+  // Built in place, the buffer keeps its capacity from one resource to the next
+  _FileName.clear();
+  _FileName.append(_OutPath).push_back('/');
+
+  switch (m_Layout)
+  {
+  case OutputLayout::Flat:
+    break;
+
+  case OutputLayout::PerType:
+    _FileName.append(Type);
+
+    // Created the first time the type shows up, unless prepared up front.
+    // A failed attempt is not recorded, the next resource of the type retries.
+    if (!m_TypeFolders.count(_TypeHash))
+    {
+      std::error_code Error;
+      std::filesystem::create_directories(_FileName, Error);
+
+      if (Error)
+        std::cerr << "Cannot create folder " << _FileName << ": " << Error.message() << std::endl;
+      else
+        m_TypeFolders.insert(_TypeHash);
+    }
+
+    _FileName.push_back('/');
+    break;
+
+  case OutputLayout::Sharded:
+    utility::AppendShard(_FileName, _NameHash);
+    _FileName.push_back('/');
+    break;
+  }
+
+  _FileName.append(NameHash, NameHashEnd).append(".").append(Type);
+}
+
+const std::string & SegmentedFileDecompressor::GetFileTypeByHash(
     const uint64_t _TypeHash
   )
 {
@@ -294,5 +964,241 @@ std::string SegmentedFileDecompressor::GetFileTypeByHash(
   if (const auto it = m_TypeHashes.find(_TypeHash); it != m_TypeHashes.end())
     return it->second;
 
-  return std::to_string(_TypeHash);
+  // Remember unknown types too, so the name is only formatted once
+  return m_TypeHashes.emplace(_TypeHash, std::to_string(_TypeHash)).first->second;
+}
+
+bool SegmentedFileDecompressor::WriteResource(
+    const std::string &   _FileName,
+    const unsigned char * _Data,
+    uint64_t              _Size
+  )
+{
+  if (m_DedupMode == DedupMode::None)
+    return utility::WriteFile(_FileName, _Data, _Size);
+
+  // MurmurHash64A takes an int length, chain the seed through 1 GiB blocks
+  uint64_t Hash = 0;
+
+  for (uint64_t Offset = 0; Offset < _Size; Offset += 1ull << 30)
+    Hash = MurmurHash64A(_Data + Offset, static_cast<int>(std::min<uint64_t>(_Size - Offset, 1ull << 30)), Hash);
+
+  const std::pair Key{ Hash, _Size };
+  std::string     Original;
+
+  {
+    std::lock_guard Lock(m_DedupMutex);
+
+    if (const auto it = m_Blobs.find(Key); it != m_Blobs.end())
+      Original = it->second;
+  }
+
+  // Originals are never written through, a rewrite unlinks them first, so
+  // the mapping compared here can't be truncated underneath
+  bool Same = !Original.empty() && IsSameContent(Original, _Data, _Size);
+
+  std::unique_lock Lock(m_DedupMutex);
+
+  // The original may have been released while it was compared
+  if (Same)
+  {
+    const auto it = m_Blobs.find(Key);
+    Same = it != m_Blobs.end() && it->second == Original;
+  }
+
+  // Same resource shipped again by another bundle, already on disk
+  if (Same && Original == _FileName)
+  {
+    m_Statistics.DuplicateResources++;
+    m_Statistics.DuplicateBytes += _Size;
+
+    return true;
+  }
+
+  ReleasePath(_FileName);
+
+  // Hash collisions keep their own copy, only the first one is shared
+  if (!Same)
+  {
+    Lock.unlock();
+
+    if (!utility::WriteFile(_FileName, _Data, _Size))
+      return false;
+
+    // Published once complete, so other writers never compare against a partial file
+    Lock.lock();
+
+    if (m_Blobs.try_emplace(Key, _FileName).second)
+      m_Originals[_FileName] = Key;
+
+    return true;
+  }
+
+  m_Statistics.DuplicateResources++;
+  m_Statistics.DuplicateBytes += _Size;
+
+  std::error_code Error;
+
+  switch (m_DedupMode)
+  {
+  case DedupMode::Manifest:
+    m_Duplicates[_FileName] = Original;
+    return true;
+
+  case DedupMode::Reflink:
+    if (CloneFile(Original, _FileName))
+      return true;
+
+    [[fallthrough]];
+
+  case DedupMode::Hardlink:
+    std::filesystem::remove(_FileName, Error);
+    std::filesystem::create_hard_link(Original, _FileName, Error);
+
+    if (!Error)
+      return true;
+
+    break;
+
+  default:
+    break;
+  }
+
+  // Filesystem can't share the data, fall back to a plain copy
+  return utility::WriteFile(_FileName, _Data, _Size);
 }
+
+void SegmentedFileDecompressor::ReleasePath(
+    const std::string & _FileName
+  )
+{
+  m_Duplicates.erase(_FileName);
+
+  const auto it = m_Originals.find(_FileName);
+
+  if (it != m_Originals.end())
+  {
+    const std::pair Key = it->second;
+
+    m_Originals.erase(it);
+    m_Blobs.erase(Key);
+
+    // Manifest duplicates only exist as entries, the first of them takes the
+    // file over and becomes the original of the rest
+    std::string Heir;
+
+    for (auto & [Duplicate, Original] : m_Duplicates)
+    {
+      if (Original != _FileName)
+        continue;
+
+      if (Heir.empty())
+        Heir = Duplicate;
+
+      Original = Heir;
+    }
+
+    if (!Heir.empty())
+    {
+      std::error_code Error;
+      std::filesystem::rename(_FileName, Heir, Error);
+
+      if (Error)
+        std::cerr << "Cannot move " << _FileName << " to " << Heir << ", the dedup manifest lists it anyway" << std::endl;
+
+      m_Duplicates.erase(Heir);
+      m_Blobs[Key]      = Heir;
+      m_Originals[Heir] = Key;
+
+      return;
+    }
+  }
+
+  std::error_code Error;
+  std::filesystem::remove(_FileName, Error);
+}
+
+bool SegmentedFileDecompressor::WriteManifest()
+{
+  if (m_DedupMode != DedupMode::Manifest)
+    return true;
+
+  for (const auto & [Duplicate, Original] : m_Duplicates)
+    m_Manifest << Duplicate << '\t' << Original << '\n';
+
+  m_Duplicates.clear();
+  m_Manifest.flush();
+
+  return m_Manifest.good();
+}
+
+bool SegmentedFileDecompressor::IsSameContent(
+    const std::string &   _FileName,
+    const unsigned char * _Data,
+    uint64_t              _Size
+  ) const
+{
+  MappedFile File;
+
+  if (!File.Open(_FileName) || File.GetSize() != _Size)
+    return false;
+
+  return _Size == 0 || std::memcmp(File.GetData(), _Data, _Size) == 0;
+}
+
+bool SegmentedFileDecompressor::CloneFile(
+    const std::string & _Source,
+    const std::string & _FileName
+  ) const
+{
+#ifdef __linux__
+
+  const int Source = open(_Source.c_str(), O_RDONLY);
+  const int Target = open(_FileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  const bool Cloned = Source >= 0 && Target >= 0 && ioctl(Target, FICLONE, Source) == 0;
+
+  if (Source >= 0)
+    close(Source);
+
+  if (Target >= 0)
+    close(Target);
+
+  return Cloned;
+
+#else
+
+  return false;
+
+#endif
+}
+
+template <typename TContainer>
+void SegmentedFileDecompressor::ReserveBuffer(
+    TContainer & _Buffer,
+    size_t       _Size
+  )
+{
+  if (_Buffer.capacity() >= _Size)
+    return;
+
+  // Grow geometrically so a slowly growing package doesn't reallocate per segment
+  const size_t Capacity = std::max(_Size, _Buffer.capacity() * 2);
+
+  if constexpr (std::is_same_v<TContainer, PackageBuffer>)
+  {
+    // vector moves the bytes over one at a time with a custom allocator
+    PackageBuffer Grown;
+    Grown.reserve(Capacity);
+    Grown.resize(_Buffer.size());
+
+    std::memcpy(Grown.data(), _Buffer.data(), _Buffer.size());
+    _Buffer.swap(Grown);
+  }
+  else
+  {
+    _Buffer.reserve(Capacity);
+  }
+
+  m_Statistics.BufferAllocations++;
+}
\ No newline at end of file
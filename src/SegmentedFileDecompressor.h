@@ -2,9 +2,48 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <fstream>
+#include <mutex>
+#include <memory>
+#include <unordered_set>
+
+#include "ResourceFilter.h"
+#include "HeaderCache.h"
+#include "Readahead.h"
 
 class SegmentedFileDecompressor
 {
+public: // Types
+
+  enum class DedupMode
+  {
+    None,     // Every copy is written
+    Hardlink, // Duplicates become hardlinks to the first copy
+    Reflink,  // Duplicates share extents with the first copy, hardlinks where unsupported
+    Manifest  // Duplicates are only listed in the dedup manifest
+  };
+
+  enum class OutputLayout
+  {
+    Flat,    // OutFolder/Name.type
+    PerType, // OutFolder/type/Name.type
+    Sharded  // OutFolder/xx/Name.type, xx being the top byte of the name hash
+  };
+
+  struct Statistics
+  {
+    uint64_t BundlesProcessed = 0;
+    uint64_t BufferAllocations = 0; // Pooled buffer growths, stays flat once warmed up
+    uint64_t HeapAllocations = 0;   // All of them in the sequential per bundle loop, debug builds only
+    uint64_t DuplicateResources = 0;
+    uint64_t DuplicateBytes = 0;
+    uint64_t WriteFailures = 0;     // Resources that could not be written, or only partly
+    uint64_t PeakBytesInFlight = 0; // Pipelined unpack only
+    uint64_t ResourcesSkipped = 0;  // Filtered unpack only
+    uint64_t SegmentsInflated = 0;  // Filtered unpack only
+    uint64_t SegmentsTotal = 0;     // Filtered unpack only
+  };
+
 public: // Interface
 
   bool Decompress(
@@ -12,23 +51,194 @@ public: // Interface
       const std::string & _OutputFolder
 	);
 
+  // Non zero runs the staged read / inflate / parse / write pipeline,
+  // holding at most that many bytes in flight
+  void SetMemoryLimit(
+      uint64_t _Bytes
+    );
+
+  // Inflate threads of the pipeline, hardware concurrency when zero
+  void SetThreadCount(
+      uint32_t _Count
+    );
+
+  void SetDedupMode(
+      DedupMode _Mode
+    );
+
+  // Large unpacks keep directories small with PerType or Sharded
+  void SetOutputLayout(
+      OutputLayout _Layout
+    );
+
+  // Compressed segments kept resident ahead of the sequential reader, 0 (the default) disables
+  void SetReadahead(
+      uint32_t _Segments
+    );
+
+  // A non empty filter only inflates the segments matching resources live in
+  void SetFilter(
+      const ResourceFilter & _Filter
+    );
+
+  // Filtered unpacks open bundles through this header cache and refresh it
+  void SetHeaderCache(
+      const std::string & _FileName
+    );
+
+  const Statistics & GetStatistics() const;
+
+protected: // Types
+
+  // Growing leaves the new bytes uninitialized, they are inflated over anyway
+  template <typename T>
+  struct UninitializedAllocator : std::allocator<T>
+  {
+    template <typename U>
+    struct rebind
+    {
+      using other = UninitializedAllocator<U>;
+    };
+
+    using std::allocator<T>::allocator;
+
+    template <typename U>
+    void construct(U * _Pointer)
+    {
+      ::new (static_cast<void *>(_Pointer)) U;
+    }
+
+    template <typename U, typename... TArgs>
+    void construct(U * _Pointer, TArgs &&... _Args)
+    {
+      ::new (static_cast<void *>(_Pointer)) U(std::forward<TArgs>(_Args)...);
+    }
+  };
+
+  using PackageBuffer = std::vector<unsigned char, UninitializedAllocator<unsigned char>>;
+
 protected: // Service
 
-  std::vector<unsigned char> ReadSegmentCompressedFile(
+  const PackageBuffer & ReadSegmentCompressedFile(
       const std::string & _FileName
-    ) const;
+    );
+
+  bool DecompressPipelined(
+      const std::vector<std::string> & _Files,
+      const std::string &              _OutFolder
+    );
+
+  bool DecompressFiltered(
+      const std::string & _Folder,
+      const std::string & _OutFolder
+    );
 
   int32_t UnpackBitsquidPackage(
-      const std::vector<unsigned char> & _Data,
-      const std::string &                _OutPath
+      const PackageBuffer & _Data,
+      const std::string &   _OutPath
+    );
+
+  // Creates the output folder and, for the sharded layout, every shard up front
+  bool PrepareOutputFolders(
+      const std::string & _OutFolder
     );
 
-  std::string GetFileTypeByHash(
+  // Spreads the creation of many folders over the worker threads
+  bool CreateFolders(
+      const std::vector<std::string> & _Folders
+    ) const;
+
+  void BuildOutputFileName(
+      std::string &       _FileName,
+      const std::string & _OutPath,
+      uint64_t            _TypeHash,
+      uint64_t            _NameHash
+    );
+
+  const std::string & GetFileTypeByHash(
       const uint64_t _TypeHash
     );
 
+  bool WriteResource(
+      const std::string &   _FileName,
+      const unsigned char * _Data,
+      uint64_t              _Size
+    );
+
+  // Called with m_DedupMutex held before _FileName is written again. The
+  // path stops being an original and its old file is unlinked, links to it
+  // keep the old bytes and manifest duplicates of it inherit the file.
+  void ReleasePath(
+      const std::string & _FileName
+    );
+
+  bool WriteManifest();
+
+  bool IsSameContent(
+      const std::string &   _FileName,
+      const unsigned char * _Data,
+      uint64_t              _Size
+    ) const;
+
+  bool CloneFile(
+      const std::string & _Source,
+      const std::string & _FileName
+    ) const;
+
+  template <typename TContainer>
+  void ReserveBuffer(
+      TContainer & _Buffer,
+      size_t       _Size
+    );
+
 protected: // Members
 
+  struct Record
+  {
+    uint64_t TypeHash;
+    uint64_t NameHash;
+  };
+
+  struct ResourceData
+  {
+    int32_t  _;
+    uint32_t FileSize;
+    uint32_t StreamSize; // Size in the .stream file, not part of the bundle
+  };
+
+  // Transient per-bundle storage, reused across bundles so a directory unpack
+  // only allocates while the buffers grow to the largest bundle seen
+  struct Buffers
+  {
+    PackageBuffer             Package;
+    std::vector<Record>       Records;
+    std::vector<ResourceData> Chunks;
+    std::string               FileName;
+  };
+
 	std::string                     m_Folder;
   std::map<uint64_t, std::string> m_TypeHashes;
+  Buffers                         m_Buffers;
+  Statistics                      m_Statistics;
+
+  ResourceFilter                                        m_Filter;
+  HeaderCache                                           m_Headers;
+  std::string                                           m_HeaderCacheFile;
+  Readahead                                             m_Readahead;
+  uint64_t                                              m_MemoryLimit = 0;
+  uint32_t                                              m_ThreadCount = 0;
+
+  OutputLayout                                          m_Layout = OutputLayout::Flat;
+  std::unordered_set<uint64_t>                          m_TypeFolders; // PerType folders already created
+
+  DedupMode                                             m_DedupMode = DedupMode::None;
+  std::mutex                                            m_DedupMutex;
+
+  // First written copy of every distinct payload, keyed by (hash, size), and back
+  std::map<std::pair<uint64_t, uint64_t>, std::string>  m_Blobs;
+  std::map<std::string, std::pair<uint64_t, uint64_t>>  m_Originals;
+
+  // Manifest mode, duplicate path -> original path, written once the unpack is done
+  std::map<std::string, std::string>                    m_Duplicates;
+  std::ofstream                                         m_Manifest;
 };
\ No newline at end of file